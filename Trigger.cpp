@@ -25,8 +25,11 @@
 */
 
 #include <assert.h>
+#include <string.h>
+#include <execinfo.h>
 #include <iostream>
 #include "Trigger.h"
+#include "inter.h"
 
 Class :: FactoryMethodMap* Class :: fmMap ;
 
@@ -51,3 +54,149 @@ void Class :: Register( std::string s, FactoryMethod m )
     fmMap = new std::map< std::string, FactoryMethod > ;
   fmMap->insert( std::pair< std::string, FactoryMethod >( s, m ) ) ;
 }
+
+FunctionId lfi_lookup_function(const char* name)
+{
+  /* only called when a trigger is initialized, a linear scan is enough */
+  for (int i = 0; i < lfi_function_count; ++i)
+    if (0 == strcmp(lfi_function_names[i], name))
+      return i;
+  return LFI_FN_NONE;
+}
+
+const char* lfi_function_name(FunctionId id)
+{
+  if (id < 0 || id >= lfi_function_count)
+    return "";
+  return lfi_function_names[id];
+}
+
+void Trigger :: Attach( FunctionId functionId, int row )
+{
+  rows.push_back( pair< FunctionId, int >( functionId, row ) ) ;
+}
+
+void Trigger :: Disarm()
+{
+  SetArmed( false ) ;
+}
+
+void Trigger :: Rearm()
+{
+  SetArmed( true ) ;
+}
+
+void Trigger :: SetArmed( bool value )
+{
+  if( armed == value )
+    return ;
+  armed = value ;
+  for( vector< pair< FunctionId, int > >::iterator it = rows.begin() ; it != rows.end() ; ++it )
+    lfi_update_row( it->first, it->second ) ;
+}
+
+/* at most this many frames of LFI code sit between a trigger and the target */
+#define LFI_RUNTIME_FRAMES  16
+
+int CallContext :: Backtrace( void** frames, int depth ) const
+{
+  void* buffer[LFI_STACK_DEPTH + LFI_RUNTIME_FRAMES];
+  int n, first, want;
+
+  if (depth > LFI_STACK_DEPTH)
+    depth = LFI_STACK_DEPTH;
+
+  if (stack.returnCount < depth && !stack.returnComplete)
+  {
+    /* round up, the next trigger likely wants a few more frames */
+    want = (depth < 16 ? 16 : depth) + LFI_RUNTIME_FRAMES;
+    n = backtrace(buffer, want);
+
+    /* skip LFI's own frames, the first of the target's is returnAddress */
+    for (first = 0; first < n && buffer[first] != returnAddress; ++first)
+      ;
+    if (first < n)
+    {
+      stack.returnCount = n - first > LFI_STACK_DEPTH ? LFI_STACK_DEPTH : n - first;
+      memcpy(stack.returnAddresses, buffer + first, stack.returnCount * sizeof(void*));
+      stack.returnComplete = (n < want);
+    }
+    else
+    {
+      /* couldn't unwind through the stub, only the caller is known */
+      stack.returnAddresses[0] = returnAddress;
+      stack.returnCount = 1;
+      stack.returnComplete = true;
+    }
+  }
+
+  if (depth > stack.returnCount)
+    depth = stack.returnCount;
+  if (frames)
+    memcpy(frames, stack.returnAddresses, depth * sizeof(void*));
+  return depth;
+}
+
+void* CallContext :: ReturnAddress( int frame ) const
+{
+  if (0 == frame)
+    return returnAddress;
+  if (frame < 0 || Backtrace(NULL, frame + 1) <= frame)
+    return NULL;
+  return stack.returnAddresses[frame];
+}
+
+struct frame_layout
+{
+  struct frame_layout* bp;
+  void* ret;
+};
+
+/* a saved frame pointer that can be followed from fp */
+static bool next_frame_ok( struct frame_layout* fp, struct frame_layout* next )
+{
+  return next > fp && (char*)next - (char*)fp < (1 << 20) &&
+         0 == ((unsigned long)next & (sizeof(void*) - 1));
+}
+
+void* CallContext :: FramePointer( int frame ) const
+{
+  struct frame_layout *fp, *next;
+  int hops;
+
+  if (!stack.framesDone)
+  {
+    stack.framesDone = true;
+
+    /* the stub's frame is the one returning to returnAddress */
+    fp = (struct frame_layout*)__builtin_frame_address(0);
+    for (hops = 0; fp && fp->ret != returnAddress; ++hops)
+    {
+      next = fp->bp;
+      fp = (hops < LFI_RUNTIME_FRAMES && next_frame_ok(fp, next)) ? next : NULL;
+    }
+
+    if (fp && next_frame_ok(fp, fp->bp))
+    {
+      fp = fp->bp;
+      stack.framePointers[0] = fp;
+      for (stack.frameCount = 1; stack.frameCount < LFI_STACK_DEPTH; ++stack.frameCount)
+      {
+        if (!next_frame_ok(fp, fp->bp))
+          break;
+        fp = fp->bp;
+        stack.framePointers[stack.frameCount] = fp;
+      }
+    }
+  }
+
+  if (frame < 0 || frame >= stack.frameCount)
+    return NULL;
+  return stack.framePointers[frame];
+}
+
+bool Trigger :: Evaluate( const CallContext& ctx )
+{
+  return Eval( ctx.functionId, ctx.args[0], ctx.args[1], ctx.args[2],
+               ctx.args[3], ctx.args[4], ctx.args[5] ) ;
+}
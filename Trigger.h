@@ -24,7 +24,11 @@
      Switzerland
 */
 
-#include <libxml/tree.h>
+#pragma once
+
+#include "TriggerArg.h"
+#include <pthread.h>
+#include <stdint.h>
 #include <vector>
 #include <string>
 #include <map>
@@ -32,11 +36,144 @@
 
 using namespace std;
 
+/*
+   compile-time identifier of an intercepted function, assigned by libfi
+   (LFI_FN_<name> in the generated stub file). Triggers that need to tell
+   functions apart should resolve the ids they care about once, using
+   lfi_lookup_function, and compare integers when evaluating
+*/
+typedef int FunctionId;
+
+#define LFI_FN_NONE  (-1)
+
+/* returns LFI_FN_NONE if the function is not intercepted by the current plan */
+FunctionId lfi_lookup_function(const char* name);
+const char* lfi_function_name(FunctionId id);
+
+/* recomputes the armed bit of a function row (see Trigger::Disarm) */
+void lfi_update_row(FunctionId functionId, int row);
+
+/*
+   changes every time an object is loaded or unloaded (the loader's
+   count, dlopen isn't interposed): triggers that keep addresses of the
+   loaded objects compare it with the one they built them for, instead
+   of walking the objects
+*/
+unsigned long lfi_objects_generation();
+
+/* calls made by a thread with no_intercept set are never evaluated */
+long get_no_intercept();
+void set_no_intercept(long);
+
+/* the deepest stack a trigger can look at through the CallContext */
+#define LFI_STACK_DEPTH  64
+
+/*
+   the stack of an intercepted call, captured lazily by CallContext: the
+   first trigger that needs frames pays for the unwinding, the others
+   reuse them (a deeper request captures the stack again). Frame 0 is the
+   caller of the intercepted function
+*/
+struct CallStack
+{
+  /* unwound with backtrace(), so they don't depend on frame pointers */
+  void* returnAddresses[LFI_STACK_DEPTH];
+  int returnCount;
+  bool returnComplete; /* the whole stack fits in returnAddresses */
+  /* frame pointer chain, framePointers[i] is frame i's saved rbp/ebp */
+  void* framePointers[LFI_STACK_DEPTH];
+  int frameCount;
+  bool framesDone;
+
+  CallStack() : returnCount(0), returnComplete(false), frameCount(0), framesDone(false) {}
+};
+
+/*
+   everything known about an intercepted call, built once by the runtime
+   and shared by all the triggers evaluated for that call
+*/
+struct CallContext
+{
+  FunctionId functionId;
+  /* raw integer argument registers, in calling convention order */
+  long args[6];
+  /* address the intercepted function returns to (in its caller) */
+  void* returnAddress;
+  pthread_t thread;
+  /* time stamp counter when the call was intercepted */
+  uint64_t tsc;
+
+  /*
+     fills frames with (at most depth) return addresses, frames[0] being
+     returnAddress, and returns how many there are
+  */
+  int Backtrace(void** frames, int depth) const;
+  /* the return address of frame i (0 is returnAddress), NULL past the end */
+  void* ReturnAddress(int frame) const;
+  /*
+     the frame pointer of frame i, following the saved frame pointers (the
+     code must keep them), NULL past the end or if the chain is broken
+  */
+  void* FramePointer(int frame) const;
+
+  mutable CallStack stack;
+};
+
 class Trigger
 {
 public:
-  virtual void Init(xmlNodePtr initData) {}
-  virtual bool Eval(const string* functionName, ...) = 0;
+  Trigger() : armed(true) {}
+  /* the trigger's <args> in the plan (see TriggerArg.h), NULL if it has none */
+  virtual void Init(const TriggerArg* args) {}
+  /* returns true if the fault should be injected in this call */
+  virtual bool Evaluate(const CallContext& ctx);
+  /*
+     varargs interface, kept for compatibility: the default Evaluate passes
+     the function id and all six arguments to it
+  */
+  virtual bool Eval(FunctionId functionId, ...) { return false; }
+
+  /*
+     a parameter changed while the target runs, through the control page
+     (see control.h and lfictl). Returns false if there is no such parameter
+  */
+  virtual bool SetParam(const char* name, long value) { return false; }
+
+  /*
+     called in each child of the fork server (see forkserver.h), in the
+     experiment's directory, before it goes on from the stop point: for
+     the state fork doesn't carry over (threads) or that the experiments
+     mustn't share. experiment numbers them in the campaign, from 0
+  */
+  virtual void StartExperiment(unsigned experiment) {}
+
+  /*
+     true if evaluating the trigger changes its state or has side effects
+     (it counts calls, draws random numbers, records or prints them): the
+     rows where it comes before a disarmed trigger are still evaluated
+  */
+  virtual bool ObservesCalls() const { return false; }
+
+  /* called by the runtime for every function row the trigger appears in */
+  void Attach(FunctionId functionId, int row);
+  bool IsArmed() const { return armed; }
+
+protected:
+  /*
+     a disarmed trigger promises to evaluate to false until it is rearmed.
+     The stubs skip the rows containing it without calling determine_action,
+     unless a trigger before it in the row observes calls: the triggers
+     before it see every call, as if it returned false, and the ones after
+     it never would
+  */
+  void Disarm();
+  void Rearm();
+
+private:
+  void SetArmed(bool value);
+
+  volatile bool armed;
+  vector< pair<FunctionId, int> > rows;
 };
 
 typedef Trigger* (*FactoryMethod)() ;
@@ -94,9 +231,20 @@ private :
   static const RegEntry r ;
 } ;
 
+/*
+   triggers are instantiated by the stub library constructor, so the
+   registrations must be complete by then, regardless of link order
+*/
+#ifdef __APPLE__
+#define LFI_REGISTRY_INIT
+#else
+#define LFI_REGISTRY_INIT __attribute__ ((init_priority (101)))
+#endif
+
 template< class T, const char S[] > const RegEntry 
-Registered< T, S > :: r = RegEntry( S, Registered< T, S >::newInstance ) ;
+Registered< T, S > :: r LFI_REGISTRY_INIT = RegEntry( S, Registered< T, S >::newInstance ) ;
 
+/* inline, so that the stubs generated by libfi -s can include the headers */
 #define DEFINE_TRIGGER( C ) \
-char C##Name__[] = #C ; \
+inline char C##Name__[] = #C ; \
 class C : public Registered< C, C##Name__ >, public Trigger
@@ -0,0 +1,49 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+#pragma once
+
+/*
+   the <args> of a trigger in the plan, as handed to Trigger::Init: one
+   node per XML element, decoded by libfi when it reads the plan, so the
+   target process never parses XML. The root node is the <args> element
+   itself, e.g.
+
+     <args><callcount>3</callcount><perthread/></args>
+
+   is "args" with the children "callcount" (text "3", value 3) and
+   "perthread" (text "")
+*/
+struct TriggerArg
+{
+  const char* name;
+  /* the text of the element, without surrounding white space */
+  const char* text;
+  /* text as a number (strtol, base 0), 0 if it isn't one */
+  long value;
+  const TriggerArg* children;
+  const TriggerArg* next;
+};
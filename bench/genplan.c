@@ -0,0 +1,66 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   writes a plan with many rows to stdout, for timing libfi on plans the
+   size of a whole-library profile: <functions> functions with <rows>
+   rows each, interleaved the way generated plans list them (one row for
+   every function, then the next row for every function)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv)
+{
+  int functions, rows, f, r;
+
+  functions = argc > 1 ? atoi(argv[1]) : 2500;
+  rows = argc > 2 ? atoi(argv[2]) : 4;
+
+  printf("<plan>\n");
+  printf("  <trigger id=\"first\" class=\"CallCountTrigger\">\n");
+  printf("    <args>\n      <callcount>1</callcount>\n    </args>\n");
+  printf("  </trigger>\n");
+  printf("  <trigger id=\"never\" class=\"RandomTrigger\">\n");
+  printf("    <args>\n      <percent>0</percent>\n    </args>\n");
+  printf("  </trigger>\n");
+  printf("  <trigger id=\"once\" class=\"SingleTrigger\" />\n");
+
+  for (r = 0; r < rows; ++r)
+    for (f = 0; f < functions; ++f)
+    {
+      printf("  <function name=\"lfi_bench_%d\" retval=\"-1\" errno=\"%s\">\n",
+             f, r % 2 ? "EINTR" : "EIO");
+      printf("    <triggerx ref=\"%s\" />\n", r ? "never" : "first");
+      if (r == rows - 1)
+        printf("    <triggerx ref=\"once\" />\n");
+      printf("  </function>\n");
+    }
+
+  printf("</plan>\n");
+  return 0;
+}
@@ -0,0 +1,67 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   read-heavy workload for the trigger evaluation: reads one byte from
+   /dev/zero in a loop and prints the average time per call. Run with the
+   stubs generated for read.xml in table and in specialized (libfi -s) mode
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+int main(int argc, char** argv)
+{
+  long calls, i, sum;
+  struct timespec start, end;
+  double ns;
+  char c;
+  int fd;
+
+  calls = argc > 1 ? atol(argv[1]) : 10000000;
+
+  fd = open("/dev/zero", O_RDONLY);
+  if (fd < 0)
+  {
+    perror("/dev/zero");
+    return 1;
+  }
+
+  sum = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < calls; ++i)
+    sum += read(fd, &c, 1);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  printf("%-15s %8.2f ns/call (%ld calls, %ld)\n",
+         argc > 2 ? argv[2] : "", ns / calls, calls, sum);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,67 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   stress test for the stateful triggers: THREADS threads call access
+   CALLS times each, all at once, so that every row of threadstress.xml is
+   evaluated concurrently. `make stress` counts the injections in inject.log
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define THREADS 64
+#define CALLS   25000
+
+static pthread_barrier_t start;
+
+static void* hammer(void* arg)
+{
+  int i;
+
+  pthread_barrier_wait(&start);
+  for (i = 0; i < CALLS; ++i)
+    access("/", F_OK);
+  return NULL;
+}
+
+int main(void)
+{
+  pthread_t threads[THREADS];
+  int i;
+
+  pthread_barrier_init(&start, NULL, THREADS);
+  for (i = 0; i < THREADS; ++i)
+    if (pthread_create(&threads[i], NULL, hammer, NULL))
+    {
+      perror("pthread_create");
+      return 1;
+    }
+  for (i = 0; i < THREADS; ++i)
+    pthread_join(threads[i], NULL);
+  return 0;
+}
@@ -0,0 +1,329 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   control page, see control.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "Trigger.h"
+#include "inter.h"
+#include "control.h"
+
+static struct lfi_control_header *control;
+static size_t control_size;
+static char control_name[LFI_CONTROL_NAME_SIZE + 16];
+/* the process that unlinks the page when it exits (0 for $LFI_CONTROL) */
+static pid_t control_owner;
+
+static pthread_t watcher;
+static volatile int watcher_running;
+static volatile int watcher_stop;
+/* what this process has applied, the page may be shared with others */
+static uint32_t applied_generation;
+static uint32_t *applied_serials;
+
+static int trigger_count(void)
+{
+  int n;
+
+  for (n = 0; lfi_triggers[n]; ++n)
+    ;
+  return n;
+}
+
+static void wait_for_change(uint32_t seen)
+{
+#ifdef __linux__
+  struct timespec timeout = { 1, 0 };
+
+  /* not FUTEX_PRIVATE: lfictl wakes us from another process */
+  syscall(SYS_futex, &control->generation, FUTEX_WAIT, seen, &timeout, NULL, 0);
+#else
+  struct timespec interval = { 0, 100000000 };
+
+  if (seen == control->generation)
+    nanosleep(&interval, NULL);
+#endif
+}
+
+static void wake_watchers(void)
+{
+#ifdef __linux__
+  syscall(SYS_futex, &control->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/* hands the parameters changed by lfictl to the triggers */
+static void apply_params(void)
+{
+  struct lfi_control_trigger *triggers;
+  char param[LFI_CONTROL_PARAM_SIZE];
+  uint32_t serial, i;
+  Trigger *trigger;
+
+  triggers = LFI_CONTROL_TRIGGERS(control);
+  for (i = 0; i < control->trigger_count; ++i)
+  {
+    serial = triggers[i].serial;
+    if (serial == applied_serials[i])
+      continue;
+
+    __sync_synchronize();
+    memcpy(param, triggers[i].param, sizeof(param));
+    param[sizeof(param) - 1] = 0;
+    trigger = lfi_triggers[i]->trigger;
+    triggers[i].status = trigger && trigger->SetParam(param, (long)triggers[i].value);
+    __sync_synchronize();
+    triggers[i].applied = serial;
+    applied_serials[i] = serial;
+  }
+}
+
+static void* watch_thread(void *)
+{
+  uint32_t generation;
+
+  /* this thread belongs to LFI, never inject in its calls */
+  set_no_intercept(1);
+
+  while (!watcher_stop)
+  {
+    generation = control->generation;
+    if (generation != applied_generation)
+    {
+      __sync_synchronize();
+      apply_params();
+      lfi_rearm_all();
+      applied_generation = generation;
+      control->applied = generation;
+    }
+    wait_for_change(generation);
+  }
+  return NULL;
+}
+
+static void start_watcher(void)
+{
+  watcher_stop = 0;
+  if (0 == pthread_create(&watcher, NULL, watch_thread, NULL))
+    watcher_running = 1;
+}
+
+/* the child only gets the forking thread, it needs its own watcher */
+static void atfork_child(void)
+{
+  watcher_running = 0;
+  start_watcher();
+}
+
+/* an existing page can be shared if it was created for the same plan */
+static int matches_plan(const struct lfi_control_header *header, size_t size)
+{
+  const struct lfi_control_function *functions;
+  const struct lfi_control_trigger *triggers;
+  int i;
+
+  if (size != control_size ||
+      memcmp(header->magic, LFI_CONTROL_MAGIC, sizeof(header->magic)) ||
+      header->version != LFI_CONTROL_VERSION ||
+      header->function_count != (uint32_t)lfi_function_count ||
+      header->trigger_count != (uint32_t)trigger_count())
+    return 0;
+
+  functions = LFI_CONTROL_FUNCTIONS(header);
+  for (i = 0; i < lfi_function_count; ++i)
+    if (strncmp(functions[i].name, lfi_function_names[i], LFI_CONTROL_NAME_SIZE - 1))
+      return 0;
+  triggers = LFI_CONTROL_TRIGGERS(header);
+  for (i = 0; lfi_triggers[i]; ++i)
+    if (strncmp(triggers[i].id, lfi_triggers[i]->id, LFI_CONTROL_NAME_SIZE - 1))
+      return 0;
+  return 1;
+}
+
+/*
+   libfi rejects trigger ids and classes that don't fit, but function names
+   (mangled ones, say) can be longer: those keep their first
+   LFI_CONTROL_NAME_SIZE - 1 characters, which is what lfictl and
+   matches_plan compare
+*/
+static void copy_name(char *to, const char *from)
+{
+  size_t length = strlen(from);
+
+  if (length >= LFI_CONTROL_NAME_SIZE)
+    length = LFI_CONTROL_NAME_SIZE - 1;
+  memcpy(to, from, length);
+  to[length] = 0;
+}
+
+static void init_page(struct lfi_control_header *header)
+{
+  struct lfi_control_function *functions;
+  struct lfi_control_trigger *triggers;
+  int i, row;
+
+  memset(header, 0, control_size);
+  header->version = LFI_CONTROL_VERSION;
+  header->size = control_size;
+  header->function_count = lfi_function_count;
+  header->trigger_count = trigger_count();
+  header->pid = getpid();
+
+  functions = LFI_CONTROL_FUNCTIONS(header);
+  for (i = 0; i < lfi_function_count; ++i)
+  {
+    copy_name(functions[i].name, lfi_function_names[i]);
+    for (row = 0; lfi_function_info[i][row].function_id != LFI_FN_NONE; ++row)
+      ;
+    functions[i].row_count = row;
+    functions[i].enabled = ~0ULL;
+  }
+  triggers = LFI_CONTROL_TRIGGERS(header);
+  for (i = 0; lfi_triggers[i]; ++i)
+  {
+    copy_name(triggers[i].id, lfi_triggers[i]->id);
+    copy_name(triggers[i].tclass, lfi_triggers[i]->tclass);
+  }
+
+  /* lfictl checks the magic first */
+  __sync_synchronize();
+  memcpy(header->magic, LFI_CONTROL_MAGIC, sizeof(header->magic));
+}
+
+static struct lfi_control_header* map_page(void)
+{
+  struct lfi_control_header *header;
+  const char *env;
+  struct stat st;
+  int fd;
+
+  env = getenv(LFI_CONTROL_ENV);
+  if (env && env[0])
+  {
+    snprintf(control_name, sizeof(control_name), "%s%s", '/' == env[0] ? "" : "/", env);
+    control_owner = 0;
+  }
+  else
+  {
+    snprintf(control_name, sizeof(control_name), LFI_CONTROL_PREFIX "%d", (int)getpid());
+    /* left behind by an earlier process with the same pid */
+    shm_unlink(control_name);
+    control_owner = getpid();
+  }
+
+  if ((fd = shm_open(control_name, O_RDWR | O_CREAT, 0600)) < 0)
+    return NULL;
+  /* processes sharing $LFI_CONTROL may start at the same time */
+  flock(fd, LOCK_EX);
+
+  header = NULL;
+  if (0 == fstat(fd, &st) &&
+      ((size_t)st.st_size == control_size || 0 == ftruncate(fd, control_size)))
+  {
+    header = (struct lfi_control_header*)mmap(NULL, control_size, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED, fd, 0);
+    if (MAP_FAILED == header)
+      header = NULL;
+    else if (!matches_plan(header, st.st_size))
+      init_page(header);
+  }
+
+  flock(fd, LOCK_UN);
+  close(fd);
+  return header;
+}
+
+/************************************************************************/
+/* maps the control page (or, if shared memory is unavailable, a        */
+/* private one, so that the rest of the runtime doesn't have to care)   */
+/* and starts the thread applying the changes made by lfictl            */
+/************************************************************************/
+void lfi_control_init(void)
+{
+  control_size = LFI_CONTROL_SIZE(lfi_function_count, trigger_count());
+
+  if (!(control = map_page()))
+  {
+    control_name[0] = 0;
+    control = (struct lfi_control_header*)mmap(NULL, control_size, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == control)
+    {
+      control = NULL;
+      return;
+    }
+    init_page(control);
+    return;
+  }
+
+  applied_serials = (uint32_t*)calloc(control->trigger_count + 1, sizeof(uint32_t));
+  if (!applied_serials)
+    return;
+  /* the page may already hold changes, made for the other processes */
+  applied_generation = 0;
+  pthread_atfork(NULL, NULL, atfork_child);
+  start_watcher();
+}
+
+void lfi_control_fini(void)
+{
+  if (watcher_running)
+  {
+    watcher_stop = 1;
+    wake_watchers();
+    pthread_join(watcher, NULL);
+    watcher_running = 0;
+  }
+  if (control_name[0] && control_owner == getpid())
+    shm_unlink(control_name);
+}
+
+struct lfi_control_function* lfi_control_function(int function_id)
+{
+  return control ? &LFI_CONTROL_FUNCTIONS(control)[function_id] : NULL;
+}
+
+int lfi_control_killed(void)
+{
+  return control && control->kill;
+}
@@ -0,0 +1,114 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+#include <stdint.h>
+
+/*
+   control page, shared between a running target and lfictl
+
+   Every stub library maps a POSIX shared memory object, /lfi-<pid> or the
+   name in $LFI_CONTROL, laid out as an lfi_control_header followed by one
+   lfi_control_function per intercepted function (in LFI_FN_<name> order)
+   and one lfi_control_trigger per trigger of the plan. lfictl changes the
+   fields marked as written by it, then increments generation and wakes the
+   futex on it; a thread of the stub library waits on generation and
+   applies the changes (recomputes lfi_armed, hands the parameters to the
+   triggers), so the stubs themselves never look at the page.
+   /lfi-<pid> is unlinked when the process exits, or by libfi after it
+   reaped a target that crashed, hung or was killed.
+
+   Processes started with the same $LFI_CONTROL (e.g. a forking server and
+   its children, or a script and the programs it runs) share one page when
+   their plans match
+*/
+
+#define LFI_CONTROL_MAGIC    "LFICTL01"
+#define LFI_CONTROL_VERSION  1
+#define LFI_CONTROL_ENV      "LFI_CONTROL"
+/* followed by the pid when $LFI_CONTROL isn't set */
+#define LFI_CONTROL_PREFIX   "/lfi-"
+#define LFI_CONTROL_NAME_SIZE   64
+#define LFI_CONTROL_PARAM_SIZE  32
+
+struct lfi_control_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t size;
+  uint32_t function_count;
+  uint32_t trigger_count;
+  int32_t pid; /* of the process that created the page */
+  /* written by lfictl: incremented after every change */
+  volatile uint32_t generation;
+  /* written by lfictl: nonzero stops all injections */
+  volatile uint32_t kill;
+  /* generation last applied by the stub library */
+  volatile uint32_t applied;
+};
+
+struct lfi_control_function
+{
+  char name[LFI_CONTROL_NAME_SIZE];
+  uint32_t row_count;
+  uint32_t reserved;
+  /* written by lfictl: rows allowed to inject, by LFI_ROW_BIT (all initially) */
+  volatile uint64_t enabled;
+};
+
+struct lfi_control_trigger
+{
+  char id[LFI_CONTROL_NAME_SIZE];
+  char tclass[LFI_CONTROL_NAME_SIZE];
+  /*
+     written by lfictl: the trigger gets SetParam(param, value) when serial
+     changes, and status tells whether it accepted it
+  */
+  char param[LFI_CONTROL_PARAM_SIZE];
+  volatile int64_t value;
+  volatile uint32_t serial;
+  volatile uint32_t applied;
+  volatile int32_t status;
+  uint32_t reserved;
+};
+
+#define LFI_CONTROL_FUNCTIONS(header) \
+  ((struct lfi_control_function*)((char*)(header) + sizeof(struct lfi_control_header)))
+#define LFI_CONTROL_TRIGGERS(header) \
+  ((struct lfi_control_trigger*)(LFI_CONTROL_FUNCTIONS(header) + (header)->function_count))
+#define LFI_CONTROL_SIZE(function_count, trigger_count) \
+  (sizeof(struct lfi_control_header) + \
+   (function_count) * sizeof(struct lfi_control_function) + \
+   (trigger_count) * sizeof(struct lfi_control_trigger))
+
+/* maps the page, called by the constructor once the triggers exist */
+void lfi_control_init(void);
+void lfi_control_fini(void);
+/* this function's entry in the page, NULL before lfi_control_init */
+struct lfi_control_function* lfi_control_function(int function_id);
+/* nonzero while lfictl has stopped all injections */
+int lfi_control_killed(void);
+/* recomputes every armed word from the triggers and the page (inter.cpp) */
+void lfi_rearm_all(void);
@@ -0,0 +1,261 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   fork server, see forkserver.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <dlfcn.h>
+#endif
+
+#include "Trigger.h"
+#include "inter.h"
+#include "control.h"
+#include "forkserver.h"
+
+int lfi_forkserver_function = -1;
+/* stop in main, see __libc_start_main */
+static int stop_in_main;
+
+static int read_all(int fd, void* buffer, size_t size)
+{
+  ssize_t n;
+
+  while (size)
+  {
+    n = read(fd, buffer, size);
+    if (n < 0 && EINTR == errno)
+      continue;
+    if (n <= 0)
+      return -1;
+    buffer = (char*)buffer + n;
+    size -= n;
+  }
+  return 0;
+}
+
+static int write_all(int fd, const void* buffer, size_t size)
+{
+  ssize_t n;
+
+  while (size)
+  {
+    n = write(fd, buffer, size);
+    if (n < 0 && EINTR == errno)
+      continue;
+    if (n <= 0)
+      return -1;
+    buffer = (const char*)buffer + n;
+    size -= n;
+  }
+  return 0;
+}
+
+/* the rows libfi enabled for this experiment, through the control page */
+static void enable_rows(const uint64_t* enabled)
+{
+  struct lfi_control_function *control;
+  int f;
+
+  for (f = 0; f < lfi_function_count; ++f)
+    if ((control = lfi_control_function(f)))
+      control->enabled = enabled ? enabled[f] : 0;
+  lfi_rearm_all();
+}
+
+void lfi_forkserver_init(void)
+{
+  const char *point;
+  int f;
+
+  point = getenv(LFI_FORKSERVER_ENV);
+  if (!point || !point[0])
+    return;
+  /* not for the programs the target runs */
+  point = strdup(point);
+  unsetenv(LFI_FORKSERVER_ENV);
+
+  if (fcntl(LFI_FORKSERVER_COMMAND_FD, F_GETFD) < 0 ||
+      fcntl(LFI_FORKSERVER_STATUS_FD, F_GETFD) < 0)
+  {
+    fprintf(stderr, "LFI: $%s is set but libfi's pipes are missing\n", LFI_FORKSERVER_ENV);
+    return;
+  }
+
+  if (0 == strcmp(point, "main"))
+  {
+#ifdef __GLIBC__
+    stop_in_main = 1;
+#else
+    fprintf(stderr, "LFI: the fork server can't stop in main here, name a function\n");
+    return;
+#endif
+  }
+  else
+  {
+    for (f = 0; f < lfi_function_count; ++f)
+      if (0 == strcmp(lfi_function_names[f], point))
+        break;
+    if (f == lfi_function_count)
+    {
+      fprintf(stderr, "LFI: the fork server can't stop in %s, it is not in the plan\n", point);
+      return;
+    }
+    lfi_forkserver_function = f;
+  }
+
+  /* nothing is injected before the stop point */
+  enable_rows(NULL);
+}
+
+void lfi_forkserver_serve(void)
+{
+  struct lfi_forkserver_hello hello;
+  struct lfi_forkserver_run run;
+  struct lfi_forkserver_status status;
+  uint64_t *enabled;
+  char dir[PATH_MAX];
+  long initial_no_intercept;
+  int wait_status, fd, i;
+  pid_t pid;
+
+  /* once: the children go on from here */
+  lfi_forkserver_function = -1;
+  stop_in_main = 0;
+  lfi_rearm_all();
+
+  initial_no_intercept = get_no_intercept();
+  set_no_intercept(1);
+
+  enabled = (uint64_t*)calloc(lfi_function_count + 1, sizeof(uint64_t));
+  hello.magic = LFI_FORKSERVER_MAGIC;
+  hello.function_count = lfi_function_count;
+  if (!enabled || write_all(LFI_FORKSERVER_STATUS_FD, &hello, sizeof(hello)))
+    _exit(1);
+
+  for (;;)
+  {
+    /* libfi is done */
+    if (read_all(LFI_FORKSERVER_COMMAND_FD, &run, sizeof(run)))
+      _exit(0);
+    if (run.magic != LFI_FORKSERVER_MAGIC || run.function_count != (uint32_t)lfi_function_count ||
+        run.dir_length >= sizeof(dir) ||
+        read_all(LFI_FORKSERVER_COMMAND_FD, enabled, lfi_function_count * sizeof(uint64_t)) ||
+        read_all(LFI_FORKSERVER_COMMAND_FD, dir, run.dir_length))
+      _exit(1);
+    dir[run.dir_length] = 0;
+
+    enable_rows(enabled);
+    /* the children would flush it again */
+    fflush(NULL);
+    pid = fork();
+    if (0 == pid)
+    {
+      close(LFI_FORKSERVER_COMMAND_FD);
+      close(LFI_FORKSERVER_STATUS_FD);
+      free(enabled);
+      if (chdir(dir))
+      {
+        perror(dir);
+        _exit(127);
+      }
+      /* the experiment's output, like the target's in a campaign */
+      fd = open("libfi.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd >= 0)
+      {
+        dup2(fd, 1);
+        dup2(fd, 2);
+        close(fd);
+      }
+      lfi_forkserver_files();
+      for (i = 0; lfi_triggers[i]; ++i)
+        if (lfi_triggers[i]->trigger)
+          lfi_triggers[i]->trigger->StartExperiment(run.experiment);
+      set_no_intercept(initial_no_intercept);
+      return;
+    }
+
+    status.pid = pid;
+    if (write_all(LFI_FORKSERVER_STATUS_FD, &status.pid, sizeof(status.pid)))
+      _exit(1);
+
+    wait_status = 0;
+    memset(&status.usage, 0, sizeof(status.usage));
+    if (pid < 0)
+      wait_status = -1;
+    else
+      while (wait4(pid, &wait_status, 0, &status.usage) < 0 && EINTR == errno)
+        ;
+    status.status = wait_status;
+    if (write_all(LFI_FORKSERVER_STATUS_FD, &status, sizeof(status)))
+      _exit(1);
+  }
+}
+
+#ifdef __GLIBC__
+/*
+   stopping in main: the preloaded library interposes the call of the
+   target's _start to __libc_start_main, so that main is entered through
+   the server once the target is initialized
+*/
+typedef int (*lfi_main_fn)(int, char**, char**);
+typedef int (*lfi_start_main_fn)(lfi_main_fn, int, char**, void (*)(void), void (*)(void),
+                                 void (*)(void), void*);
+
+static lfi_main_fn target_main;
+
+static int forkserver_main(int argc, char** argv, char** envp)
+{
+  if (stop_in_main)
+    lfi_forkserver_serve();
+  return target_main(argc, argv, envp);
+}
+
+extern "C" int __libc_start_main(lfi_main_fn main, int argc, char** argv, void (*init)(void),
+                                 void (*fini)(void), void (*rtld_fini)(void), void* stack_end)
+{
+  lfi_start_main_fn start_main;
+
+  start_main = (lfi_start_main_fn)dlsym(RTLD_NEXT, "__libc_start_main");
+  if (stop_in_main)
+  {
+    target_main = main;
+    main = forkserver_main;
+  }
+  return start_main(main, argc, argv, init, fini, rtld_fini, stack_end);
+}
+#endif
@@ -0,0 +1,93 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+#include <stdint.h>
+#include <sys/resource.h>
+
+/*
+   fork server, for campaigns where starting the target dominates
+
+   libfi -F starts the target once, with $LFI_FORKSERVER set to the point
+   where it should stop: "main" (once the target's constructors have run)
+   or the name of an intercepted function (its first call). Until then,
+   nothing is injected. There, the stub library answers on
+   LFI_FORKSERVER_STATUS_FD with an lfi_forkserver_hello and waits on
+   LFI_FORKSERVER_COMMAND_FD: for each lfi_forkserver_run (followed by
+   the rows enabled for each function, as in the control page, and the
+   experiment's directory) it arms these rows, forks a child that moves
+   to that directory and goes on from the stop point, sends its
+   pid (an int32_t, so that libfi can kill it if it hangs), waits for it
+   and sends an lfi_forkserver_status with its exit status and resource
+   usage. When libfi closes the command
+   pipe, the server exits.
+
+   Every child starts from the same state: the triggers, call counts and
+   open files of the server at the stop point. The stub library's own
+   files (inject.log, replay.bin, hang.stacks) are opened again in the
+   experiment's directory, and every trigger gets StartExperiment (see
+   Trigger.h) for what fork doesn't carry over or the experiments
+   mustn't share. Only the forking thread exists in the children, so the
+   stop point should come before the target starts its own threads
+*/
+
+#define LFI_FORKSERVER_ENV         "LFI_FORKSERVER"
+#define LFI_FORKSERVER_COMMAND_FD  198
+#define LFI_FORKSERVER_STATUS_FD   199
+#define LFI_FORKSERVER_MAGIC       0x5346464c /* "LFFS" */
+
+struct lfi_forkserver_hello
+{
+  uint32_t magic;
+  uint32_t function_count;
+};
+
+struct lfi_forkserver_run
+{
+  uint32_t magic;
+  uint32_t function_count;
+  uint32_t experiment; /* its number in the campaign, from 0 */
+  uint32_t dir_length; /* < PATH_MAX */
+  /*
+     followed by uint64_t enabled[function_count], by LFI_ROW_BIT, and by
+     the directory the experiment runs in (dir_length bytes, no NUL)
+  */
+};
+
+struct lfi_forkserver_status
+{
+  int32_t pid;
+  int32_t status; /* from waitpid */
+  struct rusage usage; /* the child's, from wait4 */
+};
+
+/* reads $LFI_FORKSERVER, called by the constructor once the rows are armed */
+void lfi_forkserver_init(void);
+/* the function whose first call is the stop point, -1 if there is none */
+extern int lfi_forkserver_function;
+/* serves libfi, returns in each child (see determine_action) */
+void lfi_forkserver_serve(void);
+/* in a child: opens the stub library's files again in the current directory (inter.cpp) */
+void lfi_forkserver_files(void);
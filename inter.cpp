@@ -32,10 +32,23 @@
 #include <time.h>
 #include <signal.h>
 #include <stdint.h>
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "Trigger.h"
 #include "inter.h"
+#include "logring.h"
+#include "replaylog.h"
+#include "control.h"
+#include "forkserver.h"
+#include "watchdog.h"
+#ifdef LFI_RUNTIME
+#include "runtime.h"
+#endif
 
 
 #ifdef __x86_64__
@@ -52,20 +65,16 @@
 extern int log_fd, replay_fd;
 extern int init_done;
 
-/* stores the return address across the original library function call */ 
-#ifdef __APPLE__ 
-pthread_key_t return_address_key; 
-#else 
-static __thread long return_address; 
-#endif 
- 
-/* avoid intercepting our function calls */ 
+/* per-thread state (see inter.h), macOS keeps the first two in thread keys */
+__thread struct lfi_thread_state lfi_thread LFI_TLS_MODEL;
 #ifdef __APPLE__
+pthread_key_t return_address_key;
 pthread_key_t no_intercept_key;
-#else
-static __thread int no_intercept;
 #endif
 
+/* see lfi_thread_index */
+static volatile int thread_count;
+
 uint64_t tsc() {
   uint32_t low, high;
   __asm__ __volatile__("rdtsc" : "=a" (low), "=d" (high));
@@ -79,6 +88,9 @@ void lfi_segv_handler(int, siginfo_t *, void *)
   struct timespec t = {0, 0};
   char message[256];
 
+  /* injections still buffered in the log rings come first */
+  lfi_log_flush();
+
   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
 
   sprintf(message, "[ %lld %ld %ld] SIGSEGV received\n", tsc(), (long)t.tv_sec, t.tv_nsec);
@@ -88,14 +100,248 @@ void lfi_segv_handler(int, siginfo_t *, void *)
   abort();
 }
 
+#ifdef LFI_STACKS_SIGNAL
+/* $LFI_STACKS, copied: the handler shouldn't look at the environment */
+static char stacks_file[PATH_MAX];
+
+/*
+   the stack of the interrupted thread, for libfi's watchdog (see
+   watchdog.h). The other threads run meanwhile and may be in their own
+   handler, so the whole record (header, frames, blank line) goes out in
+   a single write: backtrace_symbols_fd formats the frames into a pipe,
+   the record is collected from it
+*/
+static void lfi_stacks_handler(int, siginfo_t *, void *)
+{
+  void* frames[LFI_STACK_DEPTH];
+  char record[8192], drain[256];
+  long initial_no_intercept;
+  int fd, n, pipe_fds[2], saved_errno;
+  size_t length;
+  ssize_t r;
+
+  saved_errno = errno;
+  initial_no_intercept = get_no_intercept();
+  set_no_intercept(1);
+
+  fd = open(stacks_file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd >= 0)
+  {
+    n = backtrace(frames, LFI_STACK_DEPTH);
+    sprintf(record, "pid %d thread %ld:\n", (int)getpid(), (long)syscall(SYS_gettid));
+    length = strlen(record);
+    if (0 == pipe(pipe_fds))
+    {
+      backtrace_symbols_fd(frames, n, pipe_fds[1]);
+      close(pipe_fds[1]);
+      /* the frames that don't fit are dropped, the record still ends */
+      while (length < sizeof(record) - 1 &&
+             (r = read(pipe_fds[0], record + length, sizeof(record) - 1 - length)) > 0)
+        length += r;
+      while (read(pipe_fds[0], drain, sizeof(drain)) > 0)
+        ;
+      close(pipe_fds[0]);
+    }
+    record[length++] = '\n';
+    write(fd, record, length);
+    close(fd);
+  }
+
+  set_no_intercept(initial_no_intercept);
+  errno = saved_errno;
+}
+#endif
+
+void lfi_stacks_init(void)
+{
+#ifdef LFI_STACKS_SIGNAL
+  struct sigaction sa;
+  void* frame;
+  const char* env;
+
+  env = getenv(LFI_STACKS_ENV);
+  if (!env || !env[0] || strlen(env) >= sizeof(stacks_file))
+    return;
+  strcpy(stacks_file, env);
+
+  /* the first backtrace loads the unwinder, not in the handler */
+  backtrace(&frame, 1);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sa.sa_sigaction = lfi_stacks_handler;
+  sigaction(LFI_STACKS_SIGNAL, &sa, NULL);
+#endif
+}
+
+/* in a child of the fork server: its files go to the experiment's directory, the current one */
+void lfi_forkserver_files(void)
+{
+#ifdef WITH_LOGS
+  close(log_fd);
+  close(replay_fd);
+  log_fd = open(LOGFILE, 577, 0644);
+  replay_fd = open(REPLAYFILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  lfi_log_restart();
+  lfi_replay_init();
+#endif
+#ifdef LFI_STACKS_SIGNAL
+  char cwd[PATH_MAX];
+
+  if (stacks_file[0] && getcwd(cwd, sizeof(cwd)) &&
+      strlen(cwd) + 1 + strlen(LFI_STACKS_FILE) < sizeof(stacks_file))
+    sprintf(stacks_file, "%s/%s", cwd, LFI_STACKS_FILE);
+#endif
+}
+
+/************************************************************************/
+/* instantiates and initializes every trigger in the plan. Runs once,   */
+/* from the constructor, before any call is intercepted (init_done), so */
+/* the intercept path never creates triggers. Their arguments were      */
+/* decoded by libfi, there is no XML in the target                      */
+/************************************************************************/
+static void init_triggers(void)
+{
+  TriggerDesc *desc;
+  int i;
+
+  for (i = 0; (desc = lfi_triggers[i]); ++i)
+  {
+    desc->trigger = Class::newI(desc->tclass);
+    if (!desc->trigger)
+    {
+      printf("Trigger class %s not found or not yet registered (trigger %s)\n",
+             desc->tclass, desc->id);
+      continue;
+    }
+
+    desc->trigger->Init(desc->args);
+  }
+}
+
+/* serializes armed bit updates (triggers may disarm from several threads) */
+static volatile int armed_lock;
+
+static void update_row_locked(FunctionId function_id, int row)
+{
+  TriggerDesc **triggers;
+  bool armed;
+  int j;
+
+  /* until a trigger that can't fire, after which none is evaluated */
+  armed = true;
+  triggers = lfi_function_info[function_id][row].triggers;
+  for (j = 0; triggers[j]; ++j)
+  {
+    if (!triggers[j]->trigger || !triggers[j]->trigger->IsArmed())
+    {
+      armed = false;
+      break;
+    }
+    /* it must see the calls this row would evaluate */
+    if (triggers[j]->trigger->ObservesCalls())
+      break;
+  }
+
+  if (armed)
+    lfi_rows_armed[function_id] |= LFI_ROW_BIT(row);
+  else if (row < 63)
+    lfi_rows_armed[function_id] &= ~LFI_ROW_BIT(row);
+}
+
+/* what the stubs see: the armed rows, unless lfictl disabled them */
+static void publish_locked(FunctionId function_id)
+{
+  struct lfi_control_function *control;
+  unsigned long armed;
+
+  armed = lfi_rows_armed[function_id];
+  if ((control = lfi_control_function(function_id)))
+    armed &= control->enabled;
+  if (lfi_control_killed())
+    armed = 0;
+  /* any bit will do, the stop point of a fork server must reach determine_action */
+  if (function_id == lfi_forkserver_function)
+    armed |= LFI_ROW_BIT(63);
+  lfi_armed[function_id] = armed;
+}
+
+void lfi_update_row(FunctionId function_id, int row)
+{
+  while (__sync_lock_test_and_set(&armed_lock, 1))
+    ;
+  /* before that, arm_functions computes the initial state of every row */
+  if (init_done)
+  {
+    update_row_locked(function_id, row);
+    publish_locked(function_id);
+  }
+  __sync_lock_release(&armed_lock);
+}
+
+void lfi_rearm_all(void)
+{
+  int f;
+
+  while (__sync_lock_test_and_set(&armed_lock, 1))
+    ;
+  if (init_done)
+    for (f = 0; f < lfi_function_count; ++f)
+      publish_locked(f);
+  __sync_lock_release(&armed_lock);
+}
+
+/************************************************************************/
+/* attaches every trigger to the rows it appears in and arms the rows   */
+/* whose triggers are all armed. Until then, the stubs never call       */
+/* determine_action                                                     */
+/************************************************************************/
+static void arm_functions(void)
+{
+  struct fninfov2 *fn_details;
+  TriggerDesc **triggers;
+  int f, i, j;
+
+  for (f = 0; f < lfi_function_count; ++f)
+  {
+    fn_details = lfi_function_info[f];
+    for (i = 0; fn_details[i].function_id != LFI_FN_NONE; ++i)
+    {
+      triggers = fn_details[i].triggers;
+      for (j = 0; triggers[j]; ++j)
+        if (triggers[j]->trigger)
+          triggers[j]->trigger->Attach(f, i);
+    }
+  }
+
+  while (__sync_lock_test_and_set(&armed_lock, 1))
+    ;
+  init_done = 1;
+  for (f = 0; f < lfi_function_count; ++f)
+  {
+    fn_details = lfi_function_info[f];
+    for (i = 0; fn_details[i].function_id != LFI_FN_NONE; ++i)
+      update_row_locked(f, i);
+    publish_locked(f);
+  }
+  __sync_lock_release(&armed_lock);
+}
+
 void __attribute__ ((constructor)) 
 my_init(void)
 {
+#ifdef LFI_RUNTIME
+  /* the prebuilt runtime reads the plan itself */
+  if (lfi_runtime_load())
+    return;
+#endif
+  lfi_resolve_all();
 #ifdef WITH_LOGS
   log_fd = open(LOGFILE, 577, 0644);
-  replay_fd = open(REPLAYFILE, 577, 0644);
+  replay_fd = open(REPLAYFILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
 
-  write(replay_fd, "<plan>\n", 7);
+  lfi_log_init();
+  lfi_replay_init();
 #endif
 #ifdef WITH_SIGHANDLER
   struct sigaction sa;
@@ -111,14 +357,22 @@ my_init(void)
   if (err)
     write(2, "Failed to create thread keys\n", 29);
 #endif
-  init_done = 1;
+  init_triggers();
+  lfi_control_init();
+  arm_functions();
+  lfi_stacks_init();
+  lfi_forkserver_init();
+#ifdef LFI_RUNTIME
+  lfi_runtime_patch();
+#endif
 }
 
 void __attribute__ ((destructor))
 my_fini(void)
 {
+  lfi_control_fini();
 #ifdef WITH_LOGS
-  write(replay_fd, "</plan>\n", 8);
+  lfi_log_fini();
   close(replay_fd);
   close(log_fd);
 #endif
@@ -130,7 +384,7 @@ long get_return_address()
 #ifdef __APPLE__
   r = (long)pthread_getspecific(return_address_key);
 #else
-  r = return_address;
+  r = lfi_thread.return_address;
 #endif
   return r;
 }
@@ -141,7 +395,7 @@ long get_no_intercept()
 #ifdef __APPLE__
   r = (long)pthread_getspecific(no_intercept_key);
 #else
-  r = no_intercept;
+  r = lfi_thread.no_intercept;
 #endif
   return r;
 }
@@ -151,16 +405,23 @@ void set_return_address(long value)
 #ifdef __APPLE__
   pthread_setspecific(return_address_key, (void*)value);
 #else
-  return_address = value;
+  lfi_thread.return_address = value;
 #endif
 }
 
+int lfi_thread_index()
+{
+  if (!lfi_thread.thread_index)
+    lfi_thread.thread_index = __sync_add_and_fetch(&thread_count, 1);
+  return lfi_thread.thread_index;
+}
+
 void set_no_intercept(long value)
 {
 #ifdef __APPLE__
   pthread_setspecific(no_intercept_key, (void*)value);
 #else
-  no_intercept = value;
+  lfi_thread.no_intercept = value;
 #endif
 }
 
@@ -170,7 +431,9 @@ void set_no_intercept(long value)
 /* associated with the function fn when running an injection scenario   */
 /************************************************************************/
 void determine_action(struct fninfov2 fn_details[],
-              __in const char* function_name,
+              __in int function_id,
+              __in unsigned long call_index,
+              __in void* return_address,
               __in void* arg1,
               __in void* arg2,
               __in void* arg3,
@@ -182,27 +445,62 @@ void determine_action(struct fninfov2 fn_details[],
               __out int* return_code,
               __out int* return_errno)
 {
-  int err_index, i, j;
+  int err_index, i, j, fired;
   bool ev;
-  char message[256];
   static long c;
 
-  xmlDocPtr initDataDoc;
-  xmlNodePtr initData;
-
   *call_original = 1;
   *return_error = 0;
   *return_code = 0;
   *return_errno = 0;
   TriggerDesc **triggers;
+  CallContext ctx;
+
+  /* the first call to the stop point of a fork server, see forkserver.h */
+  if (function_id == lfi_forkserver_function)
+    lfi_forkserver_serve();
+
+  ctx.functionId = function_id;
+  ctx.returnAddress = return_address;
+  ctx.thread = pthread_self();
+  ctx.tsc = tsc();
+#if defined(__i386)
+  /*
+     considering first arg to be at prev_ebp+2xsizeof(long)
+     (not always the case. not really portable)
+  */
+  void* _ebp;
+  __asm__ __volatile__ ("movl %%ebp, %0"  : "=m"(_ebp) : );
+
+  long* prev_ebp = *((long**)_ebp);
+  for (i = 0; i < 6; ++i)
+    ctx.args[i] = *(prev_ebp+2+i);
+#else
+  ctx.args[0] = (long)arg1;
+  ctx.args[1] = (long)arg2;
+  ctx.args[2] = (long)arg3;
+  ctx.args[3] = (long)arg4;
+  ctx.args[4] = (long)arg5;
+  ctx.args[5] = (long)arg6;
+#endif
 
   /*
      you can think of the triggers for a function as a jagged array - fn_details[].triggers[]
      if all the triggers on one line (fn_details[i]) of the array evaluate to true,
      the error associated with that line is injected
      */
-  for (i = 0; fn_details[i].function_name[0]; ++i)
+  fired = -1;
+  if (lfi_specialized[function_id])
+  {
+    /* libfi -s: the rows are evaluated by generated code (see specialized.h) */
+    fired = lfi_specialized[function_id](ctx);
+  }
+  else for (i = 0; fn_details[i].function_id != LFI_FN_NONE; ++i)
   {
+    /* some trigger of this row is disarmed, it can't fire and nothing observes the call */
+    if (!(lfi_armed[function_id] & LFI_ROW_BIT(i)))
+      continue;
+
     triggers = fn_details[i].triggers;
     // if no triggers are defined the default behavior is to inject
     ev = true;
@@ -213,115 +511,87 @@ void determine_action(struct fninfov2 fn_details[],
          printf("%d funcs\n", c);
          */
 
+      /* instantiated by init_triggers; a missing class disables the row */
       if (!triggers[j]->trigger)
       {
-        /* TODO: make operation atomic i.e. never instantiate twice */
-        triggers[j]->trigger = Class::newI(triggers[j]->tclass);
-
-        if (!triggers[j]->trigger)
-        {
-          printf( "Trigger class %s not found or not yet registered while intercepting %s\n",
-                  triggers[j]->tclass, fn_details[i].function_name);
-          return;
-        }
-        else
-        {
-          if (triggers[j]->init[0])
-          {
-            initDataDoc = xmlParseDoc((xmlChar*)triggers[j]->init);
-
-            if (initDataDoc)
-              initData = xmlDocGetRootElement(initDataDoc);
-          } else {
-            initData = NULL;
-          }
-          triggers[j]->trigger->Init(initData);
-        }
-      }
-
-#if defined(__i386)
-      /*
-         considering first arg to be at prev_ebp+2xsizeof(long)
-         (not always the case. not really portable)
-      */
-      void* _ebp;
-       __asm__ __volatile__ ("movl %%ebp, %0"  : "=m"(_ebp) : );
-
-      long* prev_ebp = *((long**)_ebp);
-      switch(fn_details[i].argc)
-      {
-      case 6:
-        arg6 = *(prev_ebp+7);
-      case 5:
-        arg5 = *(prev_ebp+6);
-      case 4:
-        arg4 = *(prev_ebp+5);
-      case 3:
-        arg3 = *(prev_ebp+4);
-      case 2:
-        arg2 = *(prev_ebp+3);
-      case 1:
-        arg1 = *(prev_ebp+2);
-      }
-#endif
-      /* consider using a char* */
-      const string fn = fn_details[i].function_name;
-      switch (fn_details[i].argc)
-      {
-      case -1:
-      case 0:
-        ev = triggers[j]->trigger->Eval(&fn);
-        break;
-      case 1:
-        ev = triggers[j]->trigger->Eval(&fn, arg1);
-        break;
-      case 2:
-        ev = triggers[j]->trigger->Eval(&fn, arg1, arg2);
-        break;
-      case 3:
-        ev = triggers[j]->trigger->Eval(&fn, arg1, arg2, arg3);
-        break;
-      case 4:
-        ev = triggers[j]->trigger->Eval(&fn, arg1, arg2, arg3, arg4);
-        break;
-      case 5:
-        ev = triggers[j]->trigger->Eval(&fn, arg1, arg2, arg3, arg4, arg5);
-        break;
-      case 6:
-        ev = triggers[j]->trigger->Eval(&fn, arg1, arg2, arg3, arg4, arg5, arg6);
-        break;
-      default:
-        printf("A maximum of 6 arguments are supported in a trigger call\n");
         ev = false;
+        break;
       }
+
+      ev = triggers[j]->trigger->Evaluate(ctx);
       if (!ev) {
         break;
       }
     }
     if (ev)
     {
-      *return_error = 1;
-      *return_code = fn_details->return_value;
-      *return_errno = fn_details->errno_value;
-      *call_original = fn_details->call_original;
+      fired = i;
       break;
     }
   }
 
-  /* the writes should be serialized (between threads) to avoid corruption */
+  if (fired >= 0)
+  {
+    *return_error = 1;
+    *return_code = fn_details[fired].return_value;
+    *return_errno = fn_details[fired].errno_value;
+    *call_original = fn_details[fired].call_original;
+  }
 
+  /*
+     the text log is buffered in a per-thread ring and written out by the
+     log flusher, the replay record goes straight to the mapped replay file
+  */
   if (*return_error)
   {
 #ifdef WITH_LOGS
-    struct timespec t = {0, 0};
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+    lfi_log_injection(function_id, *return_code, *return_errno);
+    lfi_replay_record(function_id, call_index, *return_code, *return_errno);
+#endif
+  }
+}
 
-    sprintf(message, "[ %s, %lld %ld %ld] Returning code %d; setting errno to %d\n", function_name, tsc(), (long)t.tv_sec, t.tv_nsec, *return_code, *return_errno);
-    write(log_fd, message, strlen(message));
-    fdatasync(log_fd);
+/************************************************************************/
+/* the C side of lfi_trampoline_x64 (trampoline_x64.S): the same steps  */
+/* as the FUNCTION_BODY_x64 stubs, with the arguments already saved     */
+/************************************************************************/
+typedef char lfi_saved_regs_layout[sizeof(struct lfi_saved_regs) == 192 ? 1 : -1];
 
-    sprintf(message, "<function name=\"%s\" inject=\"%d\" retval=\"%d\" errno=\"%d\" calloriginal=\"0\" />\n", function_name, call_count, *return_code, *return_errno);
-    write(replay_fd, message, strlen(message));
-#endif
+extern "C" void* lfi_trampoline_decide(int function_id, struct lfi_saved_regs* regs)
+{
+  int call_original, return_error;
+  int return_code, return_errno;
+  int initial_no_intercept;
+  unsigned long call_index;
+  void* original_fn_ptr;
+
+  call_index = LFI_COUNT_CALL(function_id);
+
+  original_fn_ptr = lfi_original[function_id];
+  if (!original_fn_ptr)
+    original_fn_ptr = lfi_resolve(function_id);
+
+  /* not armed (or the constructor is not done) */
+  if (0 == lfi_armed[function_id])
+    return original_fn_ptr;
+  initial_no_intercept = get_no_intercept();
+  if (0 != initial_no_intercept)
+    return original_fn_ptr;
+
+  set_no_intercept(1);
+  determine_action(lfi_function_info[function_id], function_id,
+                   call_index, regs->return_address,
+                   (void*)regs->args[0], (void*)regs->args[1], (void*)regs->args[2],
+                   (void*)regs->args[3], (void*)regs->args[4], (void*)regs->args[5],
+                   &call_original, &return_error, &return_code, &return_errno);
+  set_no_intercept(initial_no_intercept);
+
+  if (return_error)
+  {
+    errno = return_errno;
+    /* sign extended, so -1 is also MAP_FAILED or (void*)-1 */
+    regs->rax = return_code;
+    return NULL;
   }
+  return original_fn_ptr;
 }
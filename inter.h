@@ -39,6 +39,8 @@
 #include <execinfo.h>
 #include <time.h>
 
+#include "TriggerArg.h"
+
 class Trigger;
 
 /* the maximum number of frames in a stack trace */
@@ -46,8 +48,8 @@ class Trigger;
 /* human readable log file (overwritten at each run) */
 #define LOGFILE    "inject.log"
 #define LOGGING    0
-/* machine readable log file used for injection replay (overwritten at each run) */
-#define  REPLAYFILE  "replay.xml"
+/* binary log used for injection replay, see replaylog.h (overwritten at each run) */
+#define  REPLAYFILE  "replay.bin"
 
 #define MAXINJECT  2000000
 
@@ -69,16 +71,16 @@ struct TriggerDesc
   char id[128];
   char tclass[128];
   Trigger* trigger;
-  char init[4096];
+  const TriggerArg* args;
 };
 
 struct fninfov2
 {
-  char function_name[256];
+  int function_id; /* LFI_FN_<name>, -1 terminates a function_info_ table */
   int return_value;
   int errno_value;
   int call_original;
-  int argc;
+  int argc; /* informational, the CallContext always carries six arguments */
 
   /* custom triggers */
   TriggerDesc **triggers;
@@ -99,10 +101,42 @@ static __thread int no_intercept;
 #endif
 */
 
+/*
+   not exported from the stub library, so that the assembly trampolines
+   can address them %rip-relative (see GENERATE_TRAMPOLINE_x64)
+*/
+#define LFI_HIDDEN  __attribute__ ((visibility ("hidden")))
+
+/*
+   per-thread runtime state, in a single initial-exec TLS block. The stub
+   library is preloaded, so the block is in the static TLS area and an
+   access is a %fs-relative load rather than a call to __tls_get_addr.
+   Build with -DLFI_DYNAMIC_TLS where there is no static TLS space for it
+   (e.g. when dlopen-ing the stub library with a libc that reserves none)
+*/
+struct lfi_thread_state
+{
+  int no_intercept;     /* avoid intercepting our function calls */
+  int thread_index;     /* see lfi_thread_index */
+  long return_address;  /* across the original library function call */
+  void* log_ring;       /* see logring.cpp */
+  uint64_t random;      /* RandomTrigger's generator, 0 until it draws */
+};
+
+#if defined(LFI_DYNAMIC_TLS) || defined(__APPLE__)
+#define LFI_TLS_MODEL
+#else
+#define LFI_TLS_MODEL  __attribute__ ((tls_model ("initial-exec")))
+#endif
+
+extern __thread struct lfi_thread_state lfi_thread LFI_HIDDEN LFI_TLS_MODEL;
+
 long get_return_address();
 void set_return_address(long);
 long get_no_intercept();
 void set_no_intercept(long);
+/* 1 for the first thread that needs one, used to tag log records */
+int lfi_thread_index();
 
 /*
    avoid including the standard headers because the compiler will likely
@@ -115,8 +149,96 @@ extern "C" {
   int printf(const char * _Format, ...);
 }
 
+/*
+   the plan tables are constants of the generated stub file, except in
+   the prebuilt runtime (-DLFI_RUNTIME), which fills them when it is
+   loaded (see runtime.h)
+*/
+#ifdef LFI_RUNTIME
+#define LFI_PLAN_CONST
+#else
+#define LFI_PLAN_CONST  const
+#endif
+
+/*
+   function ids and names, indexed by LFI_FN_<name>
+   (defined in the automatically generated stub file)
+*/
+extern const char* LFI_PLAN_CONST lfi_function_names[];
+extern LFI_PLAN_CONST int lfi_function_count;
+
+/* every trigger declared in the plan, NULL terminated */
+extern TriggerDesc* lfi_triggers[];
+
+/* function_info_<name> tables, indexed by LFI_FN_<name> */
+extern struct fninfov2* lfi_function_info[];
+
+/*
+   armed words, indexed by LFI_FN_<name>. Bit r is cleared while a trigger
+   on row r of function_info_<name> is disarmed and none before it
+   observes calls (see Trigger::ObservesCalls; rows past 62 share bit 63,
+   which is never cleared). A stub whose word is 0 calls the original
+   function right away. All words stay 0 until the constructor is done
+*/
+extern volatile unsigned long lfi_armed[] LFI_HIDDEN;
+/*
+   the rows whose triggers are all armed, in the same format. lfi_armed is
+   this, minus the rows disabled through the control page (see control.h)
+*/
+extern unsigned long lfi_rows_armed[];
+
+#define LFI_ROW_BIT(row)  (1UL << ((row) < 63 ? (row) : 63))
+
+/*
+   address of the original (next) definition of each function, indexed by
+   LFI_FN_<name>, and the symbol it is looked up by (the alias, if any).
+   Filled by lfi_resolve_all in the constructor, then made read-only, so
+   lfi_original is page aligned and padded to whole pages
+*/
+extern void* lfi_original[] LFI_HIDDEN;
+extern const char* LFI_PLAN_CONST lfi_symbol_names[];
+
+#define LFI_PAGE_SIZE  4096
+#define LFI_ORIGINAL_TABLE_LENGTH(n) \
+  (((n) * sizeof(void*) + LFI_PAGE_SIZE - 1) / LFI_PAGE_SIZE * LFI_PAGE_SIZE / sizeof(void*))
+#define LFI_ORIGINAL_TABLE_SIZE(n)  (LFI_ORIGINAL_TABLE_LENGTH(n) * sizeof(void*))
+
+void lfi_resolve_all(void);
+/* slow path for the calls made before the constructor */
+void* lfi_resolve(int function_id);
+#ifndef __APPLE__
+/* the LFI_FN_<name> intercepting a symbol (an alias, if any), or -1 */
+int lfi_symbol_id(const char* symbol);
+struct dl_phdr_info;
+/* nonzero if addr is in one of the loaded segments of the object */
+int lfi_object_contains(struct dl_phdr_info *info, const void *addr);
+#endif
+
+/*
+   calls made to each function, indexed by LFI_FN_<name>. Only counted
+   when building WITH_LOGS, for the replay log
+*/
+extern volatile unsigned long lfi_call_counts[];
+
+#ifdef WITH_LOGS
+#define LFI_COUNT_CALL(FUNCTION_ID)  __sync_add_and_fetch(&lfi_call_counts[FUNCTION_ID], 1)
+#else
+#define LFI_COUNT_CALL(FUNCTION_ID)  0
+#endif
+
+/*
+   decision functions generated by libfi -s, indexed by LFI_FN_<name>
+   (NULL in the default, table-driven, mode): return the row of
+   function_info_<name> that fires, or -1
+*/
+struct CallContext;
+typedef int (*lfi_decide_fn)(const CallContext& ctx);
+extern const lfi_decide_fn lfi_specialized[];
+
 void determine_action(struct fninfov2 fn_details[],
-            __in const char* function_name,
+            __in int function_id,
+            __in unsigned long call_index,
+            __in void* return_address,
             __in void* arg1,
             __in void* arg2,
             __in void* arg3,
@@ -144,7 +266,11 @@ void print_backtrace(void* bt[], int nptrs, int log_fd);
   int call_original, return_error; \
   int return_code, return_errno; \
   int initial_no_intercept; \
-  static void * (*original_fn_ptr)(); \
+  int armed; \
+  unsigned long call_index; \
+  void * (*original_fn_ptr)(); \
+  \
+  call_index = LFI_COUNT_CALL(LFI_FN_ ## FUNCTION_NAME); \
   \
   /* defaults */ \
   call_original = 1; \
@@ -152,21 +278,25 @@ void print_backtrace(void* bt[], int nptrs, int log_fd);
   return_code = 0; \
   return_errno = 0; \
   \
-  initial_no_intercept = get_no_intercept(); \
-  if (0 == initial_no_intercept && init_done /* don't hook open or write in the constructor */) { \
-    set_no_intercept(1); /* allow all determine_action-called functions to pass-through */ \
-    determine_action(function_info_ ## FUNCTION_NAME, #FUNCTION_NAME, \
-                     0, 0, 0, 0, 0, 0, \
-                     &call_original, &return_error, &return_code, &return_errno); \
+  /* 0 until the constructor is done (don't hook open or write in the constructor) */ \
+  armed = (0 != lfi_armed[LFI_FN_ ## FUNCTION_NAME]); \
+  if (armed) { \
+    initial_no_intercept = get_no_intercept(); \
+    if (0 == initial_no_intercept) { \
+      set_no_intercept(1); /* allow all determine_action-called functions to pass-through */ \
+      determine_action(function_info_ ## FUNCTION_NAME, LFI_FN_ ## FUNCTION_NAME, \
+                       call_index, __builtin_return_address(0), \
+                       0, 0, 0, 0, 0, 0, \
+                       &call_original, &return_error, &return_code, &return_errno); \
+    } \
   } \
   \
-  if(!original_fn_ptr) { \
-    original_fn_ptr = (void *(*)()) dlsym(RTLD_NEXT, #FUNCTION_NAME); \
-    if(!original_fn_ptr) \
-      printf("Unable to get address for function %s\n", #FUNCTION_NAME); \
-  } \
+  original_fn_ptr = (void *(*)()) lfi_original[LFI_FN_ ## FUNCTION_NAME]; \
+  if(!original_fn_ptr) \
+    original_fn_ptr = (void *(*)()) lfi_resolve(LFI_FN_ ## FUNCTION_NAME); \
   \
-  set_no_intercept(initial_no_intercept); \
+  if (armed) \
+    set_no_intercept(initial_no_intercept); \
   if (return_error) \
   { \
     errno = return_errno; \
@@ -221,13 +351,15 @@ struct reg_backup {
   int call_original, return_error; \
   int return_code, return_errno; \
   reg_backup regs; \
-  static void * (*original_fn_ptr)(); \
+  void * (*original_fn_ptr)(); \
   /* we can't call write directly because it would prevent us for injecting faults in `write`
        (injecting requires the creation of a function with the same name but the prototype is
      different). We, use dlsym instead
   */ \
   static int * (*original_write_ptr)(int, const void*, int); \
   int initial_no_intercept; \
+  int armed; \
+  unsigned long call_index; \
   \
   /* save non-volatiles */ \
   __asm__ __volatile__ ("movq %%r9, %0"  : "=m"(regs.r9) :); \
@@ -249,26 +381,28 @@ struct reg_backup {
   return_code = 0; \
   return_errno = 0; \
   nptrs = 0; \
+  call_index = LFI_COUNT_CALL(LFI_FN_ ## FUNCTION_NAME); \
   /* printf("intercepted %s\n", #FUNCTION_NAME); */ \
   \
-  if (init_done) { \
+  /* nothing can fire (or the constructor is not done): only call the original */ \
+  armed = (0 != lfi_armed[LFI_FN_ ## FUNCTION_NAME]); \
+  if (armed) { \
     initial_no_intercept = get_no_intercept(); \
     if (0 == initial_no_intercept) { \
       set_no_intercept(1); \
-      determine_action(function_info_ ## FUNCTION_NAME, #FUNCTION_NAME, \
-                       regs.rdi, regs.rsi, regs.rcx, regs.rdx, regs.r8, regs.r9, \
+      determine_action(function_info_ ## FUNCTION_NAME, LFI_FN_ ## FUNCTION_NAME, \
+                       call_index, __builtin_return_address(0), \
+                       regs.rdi, regs.rsi, regs.rdx, regs.rcx, regs.r8, regs.r9, \
                        &call_original, &return_error, &return_code, &return_errno); \
     } \
   } \
         \
   \
-  if(!original_fn_ptr) { \
-    original_fn_ptr = (void *(*)()) dlsym(RTLD_NEXT, #SYMBOL_NAME); \
-    if(!original_fn_ptr) \
-      printf("Unable to get address for function %s\n", #SYMBOL_NAME); \
-  } \
+  original_fn_ptr = (void *(*)()) lfi_original[LFI_FN_ ## FUNCTION_NAME]; \
+  if(!original_fn_ptr) \
+    original_fn_ptr = (void *(*)()) lfi_resolve(LFI_FN_ ## FUNCTION_NAME); \
   \
-  if (init_done) \
+  if (armed) \
     set_no_intercept(initial_no_intercept); \
   \
   if (return_error) \
@@ -293,12 +427,66 @@ struct reg_backup {
     __asm__ __volatile__ ("movq %0, %%r14" : : "m"(regs.r14)); \
     __asm__ __volatile__ ("movq %0, %%r15" : : "m"(regs.r15)); \
     \
-    __asm__ ("leave"); \
-    __asm__ ("jmp *%%rax" : : "a"(original_fn_ptr)); \
+    /* original_fn_ptr is a local: load it before the frame is gone */ \
+    __asm__ __volatile__ ("leave\n\tjmp *%%rax" : : "a"(original_fn_ptr)); \
   } \
 }
 
 
+/*
+   argument registers saved by lfi_trampoline_x64 (trampoline_x64.S, which
+   hardcodes the offsets), in the order of the SysV calling convention.
+   rax holds the number of vector registers used by a varargs call on the
+   way in and the injected return value on the way out
+*/
+struct lfi_saved_regs {
+  long args[6]; /* rdi, rsi, rdx, rcx, r8, r9 */
+  long rax;
+  void* return_address;
+  char xmm[8][16];
+};
+
+/*
+   called by lfi_trampoline_x64. Returns the function to tail-jump to
+   with the saved registers, or NULL to return regs->rax to the caller
+*/
+extern "C" void* lfi_trampoline_decide(int function_id, struct lfi_saved_regs* regs) LFI_HIDDEN;
+
+/***********************************************************************/
+/*  GENERATE_TRAMPOLINE_x64 - emits the entry point of an intercepted  */
+/*  function on Linux x86_64, in assembly. FUNCTION_ID must be the     */
+/*  literal value of LFI_FN_<name>. Unless the function has an armed   */
+/*  row, it jumps straight to the original with the caller's registers */
+/*  and stack untouched; otherwise it jumps to lfi_trampoline_x64 with */
+/*  the id in r11 (a scratch register in the SysV ABI)                 */
+/***********************************************************************/
+#ifdef WITH_LOGS
+/* every call is counted for the replay log, in lfi_trampoline_decide */
+#define LFI_TRAMPOLINE_FAST_PATH(FUNCTION_ID)
+#else
+#define LFI_TRAMPOLINE_FAST_PATH(FUNCTION_ID) \
+  "\tmovq lfi_original+8*" #FUNCTION_ID "(%rip), %r11\n" \
+  "\ttestq %r11, %r11\n" \
+  "\tjz 1f\n" \
+  "\tcmpq $0, lfi_armed+8*" #FUNCTION_ID "(%rip)\n" \
+  "\tjne 1f\n" \
+  "\tjmp *%r11\n" \
+  "1:\n"
+#endif
+
+#define GENERATE_TRAMPOLINE_x64(FUNCTION_NAME, SYMBOL_NAME, FUNCTION_ID) \
+  __asm__ ( \
+    "\t.pushsection .text\n" \
+    "\t.globl " #SYMBOL_NAME "\n" \
+    "\t.type " #SYMBOL_NAME ", @function\n" \
+    "\t.p2align 4\n" \
+    #SYMBOL_NAME ":\n" \
+    LFI_TRAMPOLINE_FAST_PATH(FUNCTION_ID) \
+    "\tmovl $" #FUNCTION_ID ", %r11d\n" \
+    "\tjmp lfi_trampoline_x64\n" \
+    "\t.size " #SYMBOL_NAME ", .-" #SYMBOL_NAME "\n" \
+    "\t.popsection\n");
+
 #define STUB_VAR_DECL \
 int log_fd, replay_fd; \
 int init_done; 
@@ -0,0 +1,261 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   lfictl - changes what a running target does, through its control page
+   (see control.h)
+
+     lfictl <target> status
+     lfictl <target> kill | resume
+     lfictl <target> disable | enable <function> [<row>]
+     lfictl <target> set <trigger id> <parameter> <value>
+
+   <target> is the pid of a process running with the stub library, or the
+   name it was given in $LFI_CONTROL. Rows are numbered from 0, in plan
+   order, among the rows of the function; without one, all rows change
+*/
+
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "control.h"
+
+using namespace std;
+
+static void
+usage(char* me)
+{
+  cout << "Usage: " << me << " <pid | control name> <command>" << endl;
+  cout << "  status" << endl;
+  cout << "  kill | resume" << endl;
+  cout << "  disable | enable <function> [<row>]" << endl;
+  cout << "  set <trigger id> <parameter> <value>" << endl;
+}
+
+/* lets the stub libraries sharing the page know that it changed */
+static void
+publish(struct lfi_control_header* header)
+{
+  __sync_synchronize();
+  __sync_add_and_fetch(&header->generation, 1);
+#ifdef __linux__
+  syscall(SYS_futex, &header->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+static void
+print_status(const struct lfi_control_header* header)
+{
+  const struct lfi_control_function* functions;
+  const struct lfi_control_trigger* triggers;
+  uint32_t i, row;
+
+  printf("pid %d, generation %u (applied %u)%s\n", header->pid, header->generation,
+         header->applied, header->kill ? ", killed" : "");
+
+  functions = LFI_CONTROL_FUNCTIONS(header);
+  for (i = 0; i < header->function_count; ++i)
+  {
+    printf("function %s:", functions[i].name);
+    for (row = 0; row < functions[i].row_count; ++row)
+      printf(" %u:%s", row,
+             (functions[i].enabled & (1ULL << (row < 63 ? row : 63))) ? "on" : "off");
+    printf("\n");
+  }
+
+  triggers = LFI_CONTROL_TRIGGERS(header);
+  for (i = 0; i < header->trigger_count; ++i)
+  {
+    printf("trigger %s (%s)", triggers[i].id, triggers[i].tclass);
+    if (triggers[i].serial)
+      printf(": %s=%lld %s", triggers[i].param, (long long)triggers[i].value,
+             triggers[i].applied != triggers[i].serial ? "pending" :
+             triggers[i].status ? "applied" : "rejected");
+    printf("\n");
+  }
+}
+
+static int
+set_enabled(struct lfi_control_header* header, const char* name, const char* row, int enable)
+{
+  struct lfi_control_function* functions;
+  uint64_t mask;
+  uint32_t i;
+  long r;
+
+  mask = ~0ULL;
+  if (row)
+  {
+    r = atol(row);
+    if (r < 0)
+      return -1;
+    mask = 1ULL << (r < 63 ? r : 63);
+  }
+
+  functions = LFI_CONTROL_FUNCTIONS(header);
+  for (i = 0; i < header->function_count; ++i)
+  {
+    /* longer names only keep their first LFI_CONTROL_NAME_SIZE - 1 characters */
+    if (strncmp(functions[i].name, name, LFI_CONTROL_NAME_SIZE - 1))
+      continue;
+    if (enable)
+      __sync_fetch_and_or(&functions[i].enabled, mask);
+    else
+      __sync_fetch_and_and(&functions[i].enabled, ~mask);
+    return 0;
+  }
+  return -1;
+}
+
+static int
+set_param(struct lfi_control_header* header, const char* id, const char* param, const char* value)
+{
+  struct lfi_control_trigger* triggers;
+  struct timespec interval = { 0, 10000000 };
+  uint32_t i, serial;
+  int tries;
+
+  triggers = LFI_CONTROL_TRIGGERS(header);
+  for (i = 0; i < header->trigger_count; ++i)
+    if (0 == strcmp(triggers[i].id, id))
+      break;
+  if (i == header->trigger_count || strlen(param) >= LFI_CONTROL_PARAM_SIZE)
+    return -1;
+
+  strcpy(triggers[i].param, param);
+  triggers[i].value = strtoll(value, NULL, 0);
+  __sync_synchronize();
+  serial = __sync_add_and_fetch(&triggers[i].serial, 1);
+  publish(header);
+
+  /* wait (a little) for the target to answer */
+  for (tries = 0; tries < 100 && triggers[i].applied != serial; ++tries)
+    nanosleep(&interval, NULL);
+  if (triggers[i].applied != serial)
+    cout << "not applied yet" << endl;
+  else if (!triggers[i].status)
+  {
+    cerr << triggers[i].tclass << " has no parameter " << param << endl;
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  struct lfi_control_header* header;
+  char name[LFI_CONTROL_NAME_SIZE + 16];
+  struct stat st;
+  const char* command;
+  int fd, r;
+  void* p;
+
+  if (argc < 3)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (strspn(argv[1], "0123456789") == strlen(argv[1]))
+    snprintf(name, sizeof(name), LFI_CONTROL_PREFIX "%s", argv[1]);
+  else
+    snprintf(name, sizeof(name), "%s%s", '/' == argv[1][0] ? "" : "/", argv[1]);
+
+  if ((fd = shm_open(name, O_RDWR, 0)) < 0 || fstat(fd, &st) < 0)
+  {
+    perror(name);
+    return 1;
+  }
+  if ((size_t)st.st_size < sizeof(struct lfi_control_header) ||
+      MAP_FAILED == (p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)))
+  {
+    cerr << name << ": not a control page" << endl;
+    return 1;
+  }
+  close(fd);
+
+  header = (struct lfi_control_header*)p;
+  if (memcmp(header->magic, LFI_CONTROL_MAGIC, sizeof(header->magic)) ||
+      header->version != LFI_CONTROL_VERSION ||
+      header->size != (uint32_t)st.st_size ||
+      LFI_CONTROL_SIZE(header->function_count, header->trigger_count) != header->size)
+  {
+    cerr << name << ": not a control page or unsupported version" << endl;
+    return 1;
+  }
+
+  r = 0;
+  command = argv[2];
+  if (0 == strcmp(command, "status"))
+    print_status(header);
+  else if (0 == strcmp(command, "kill") || 0 == strcmp(command, "resume"))
+  {
+    header->kill = ('k' == command[0]);
+    publish(header);
+  }
+  else if ((0 == strcmp(command, "disable") || 0 == strcmp(command, "enable")) && argc >= 4)
+  {
+    if (set_enabled(header, argv[3], argc > 4 ? argv[4] : NULL, 'e' == command[0]))
+    {
+      cerr << "No function " << argv[3] << (argc > 4 ? " or no such row" : "") << endl;
+      r = 1;
+    }
+    else
+      publish(header);
+  }
+  else if (0 == strcmp(command, "set") && argc >= 6)
+  {
+    r = set_param(header, argv[3], argv[4], argv[5]);
+    if (r < 0)
+    {
+      cerr << "No trigger " << argv[3] << " or parameter name too long" << endl;
+      r = 1;
+    }
+  }
+  else
+  {
+    usage(argv[0]);
+    r = 1;
+  }
+
+  munmap(p, st.st_size);
+  return r;
+}
@@ -26,334 +26,711 @@
 
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <map>
 #include <set>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
 #include <libxml/tree.h>
 #include <libxml/parser.h>
-#include <libxml/xpath.h>
-#include <libxml/xpathInternals.h>
+#include <libxml/xmlreader.h>
+
+#include "planfile.h"
+#include "forkserver.h"
+#include "watchdog.h"
+#include "control.h"
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/shm.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include <errno.h>
 #include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <time.h>
 #include <unistd.h>
 
 using namespace std;
 
 #define STUBC  ((char *) "intercept.stub.cpp")
+/* prebuilt, maps the compiled plan named by $LFI_PLAN (see runtime.h) */
+#define RUNTIMEEX  ((char *) "liblfi_runtime.so")
+#define PLANFILE  ((char *) "intercept.plan")
 #ifdef __APPLE__
 #define STUBEX  ((char *) "intercept.stub.dylib")
 #else
 #define STUBEX  ((char *) "intercept.stub.so")
 #endif
 
-#define LOGFILE    "inject.log"
-#define  REPLAYFILE  "replay.xml"
-
 
 #define CRASH_METRIC    (int)1e8
+#define HANG_METRIC    (int)1e7
 #define FAILURE_METRIC    (int)1e6
 #define TIME_MULTIPLIER    1
 
+/* -s: generate specialized decision functions (see specialized.h) */
+static int specialized;
+/* -r: don't generate a stub library, preload the prebuilt runtime */
+static int prebuilt;
+/* -n: write the stub file (or the compiled plan) and stop there */
+static int generate_only;
+/* -w, -c: the wall-clock and CPU time (s) a target gets, 0 without limit */
+static double wall_budget;
+static double cpu_budget;
+
+/*
+   where the stub file, stub library and compiled plan are written and
+   where the target runs, with a trailing /. Empty (the current
+   directory) but in the experiments of a campaign (see run_campaign)
+*/
+static string experiment_dir;
+
+static string experiment_path(const char* name)
+{
+  return experiment_dir + name;
+}
+
 static void
 usage(char* me)
 {
   cout << "Usage: ";
-  cout << me << " [-t <targetExecutable>] <configurationFile>" << endl;
+  cout << me << " [-s | -r] [-w <seconds>] [-c <seconds>] [-n | -t <targetExecutable>] <configurationFile>" << endl;
+  cout << me << " [-s | -r] [-w <seconds>] [-c <seconds>] [-n | -t <targetExecutable>] -j <jobs> <planDirectory | planList>" << endl;
+  cout << me << " [-s | -r] [-w <seconds>] [-c <seconds>] -F <main | function> [-j <jobs>] -t <targetExecutable> <configurationFile> <experimentList>" << endl;
 }
 
-static void
-print_attribute_names(xmlAttrPtr a_node, ofstream& out)
+/************************************************************************/
+/*  trigger arguments: the <args> element of a trigger and everything   */
+/*  under it is decoded here, into the nodes of a TriggerArg tree (see  */
+/*  TriggerArg.h), so the target never parses XML                       */
+/************************************************************************/
+struct arg_node
+{
+  string name;
+  string text;
+  long value;
+  int children; /* index of the first child, -1 if none */
+  int next;     /* index of the next sibling, -1 if none */
+};
+
+static int
+decode_args(xmlNodePtr node, vector<arg_node>& nodes)
 {
-  for (; a_node; a_node = a_node->next) {
-    out << " " << a_node->name << "=\\\"" << a_node->children->content << "\\\"";
-    if (a_node->next)
-      out << " ";
+  xmlNodePtr cur;
+  string text;
+  size_t first, last;
+  char* end;
+  int self, child, prev;
+
+  for (cur = node->children; cur; cur = cur->next)
+    if ((cur->type == XML_TEXT_NODE || cur->type == XML_CDATA_SECTION_NODE) && cur->content)
+      text += (char*)cur->content;
+  first = text.find_first_not_of(" \t\r\n");
+  last = text.find_last_not_of(" \t\r\n");
+  text = (first == string::npos) ? "" : text.substr(first, last - first + 1);
+
+  /* indexes only, nodes grows while the children are decoded */
+  self = nodes.size();
+  nodes.push_back(arg_node());
+  nodes[self].name = (char*)node->name;
+  nodes[self].text = text;
+  nodes[self].value = strtol(text.c_str(), &end, 0);
+  if (text.empty() || *end)
+    nodes[self].value = 0;
+  nodes[self].children = -1;
+  nodes[self].next = -1;
+
+  prev = -1;
+  for (cur = node->children; cur; cur = cur->next)
+  {
+    if (cur->type != XML_ELEMENT_NODE)
+      continue;
+    child = decode_args(cur, nodes);
+    if (prev < 0)
+      nodes[self].children = child;
+    else
+      nodes[prev].next = child;
+    prev = child;
   }
+  return self;
 }
 
-static void
-print_element_names(xmlNodePtr a_node, ofstream& out)
+/* the <args> element of a trigger, NULL if it has none */
+static xmlNodePtr
+find_args(xmlNodePtr trigger)
 {
-  xmlNodePtr cur_node = NULL;
-  xmlChar ch;
-  int i;
+  xmlNodePtr cur;
 
-  for (cur_node = a_node; cur_node; cur_node = cur_node->next) {
-    if (cur_node->type == XML_ELEMENT_NODE) {
-      out << "<" << cur_node->name;
-      print_attribute_names(cur_node->properties, out);
-      out << ">";
-    } else if (cur_node->type == XML_TEXT_NODE) {
-      i = 0;
-      while (0 != (ch = cur_node->content[i++]))
-      {
-        if (ch == '\r' || ch == '\n')
-          out << "\\";
-        out << ch;
-      }
-    }
+  for (cur = trigger->children; cur; cur = cur->next)
+    if (cur->type == XML_ELEMENT_NODE && 0 == xmlStrcmp(cur->name, (const xmlChar *)"args"))
+      return cur;
+  return NULL;
+}
 
-    print_element_names(cur_node->children, out);
+static string
+c_string(const string& s)
+{
+  ostringstream out;
+  char octal[8];
+  size_t i;
 
-    if (cur_node->type == XML_ELEMENT_NODE) {
-      out << "</" << cur_node->name << ">";
+  out << "\"";
+  for (i = 0; i < s.size(); ++i)
+  {
+    if (s[i] == '"' || s[i] == '\\')
+      out << "\\" << s[i];
+    else if ((unsigned char)s[i] < 0x20 || (unsigned char)s[i] >= 0x7f)
+    {
+      sprintf(octal, "\\%03o", (unsigned char)s[i]);
+      out << octal;
     }
+    else
+      out << s[i];
   }
+  out << "\"";
+  return out.str();
 }
 
-static void
-print_triggers(xmlNodeSetPtr nodes, ofstream& out)
+/************************************************************************/
+/*  the plan as libfi reads it, in a single pass over the XML (see      */
+/*  read_plan): triggers in order of declaration and functions in order */
+/*  of first appearance, each with its rows in plan order. Everything   */
+/*  that is generated from the plan walks these, not the document       */
+/************************************************************************/
+struct plan_trigger_decl
 {
-  xmlNodePtr cur;
-  xmlChar *triggerId;
-  xmlChar *triggerClass;
+  string id;
+  string tclass;         /* empty if the trigger has no class */
+  bool hasArgs;
+  vector<arg_node> args; /* decoded <args>, args[0] is the element itself */
+};
 
-  int size;
-  int i, fn_count;
-  set<string> functionsUsed;
+struct plan_row_decl
+{
+  /* as written in the plan, empty if the attribute is missing */
+  string retval;
+  string errnoValue;
+  string callOriginal;
+  string argc;
+  vector<string> refs;   /* the <triggerx> refs, in order */
+};
+
+struct plan_function_decl
+{
+  string name;
+  string symbol;         /* alias of the first occurrence, or name */
+  vector<plan_row_decl> rows;
+};
 
-  size = (nodes) ? nodes->nodeNr : 0;
-  fn_count = 0;
+struct plan_decl
+{
+  vector<plan_trigger_decl> triggers;
+  unordered_map<string, int> triggerIds;   /* id -> its last declaration */
+  vector<plan_function_decl> functions;
+  unordered_map<string, int> functionIds;  /* name -> LFI_FN_<name> */
+};
 
-  for(i = 0; i < size; ++i)
+/*
+   the <trigger> element the reader is on, with everything under it. Its
+   id and class go into the control page (control.h), which has room for
+   LFI_CONTROL_NAME_SIZE - 1 characters of each
+*/
+static int
+read_trigger(xmlTextReaderPtr reader, plan_decl& plan)
+{
+  plan_trigger_decl trigger;
+  xmlNodePtr node, args;
+  xmlChar *id, *tclass;
+
+  /* declarations are few and small, expanding them is cheap */
+  node = xmlTextReaderExpand(reader);
+  if (!node)
+    return 0;
+  id = xmlGetProp(node, (xmlChar*)"id");
+  if (!id)
+    return 0;
+  trigger.id = (char*)id;
+  xmlFree(id);
+  tclass = xmlGetProp(node, (xmlChar*)"class");
+  if (tclass)
+  {
+    trigger.tclass = (char*)tclass;
+    xmlFree(tclass);
+  }
+  trigger.hasArgs = false;
+  if ((args = find_args(node)))
   {
-    assert(nodes->nodeTab[i]);
+    trigger.hasArgs = true;
+    decode_args(args, trigger.args);
+  }
+  if (trigger.id.size() >= LFI_CONTROL_NAME_SIZE || trigger.tclass.size() >= LFI_CONTROL_NAME_SIZE)
+  {
+    cerr << "Trigger " << trigger.id << ": ids and classes are limited to "
+         << LFI_CONTROL_NAME_SIZE - 1 << " characters" << endl;
+    return -1;
+  }
 
-    cur = nodes->nodeTab[i];
-    if(cur->type == XML_ELEMENT_NODE)
+  plan.triggerIds[trigger.id] = plan.triggers.size();
+  plan.triggers.push_back(trigger);
+  return 0;
+}
+
+/* the <function> element the reader is on, up to its end tag */
+static int
+read_function(xmlTextReaderPtr reader, plan_decl& plan)
+{
+  plan_row_decl row;
+  string name, alias, attribute;
+  xmlChar* ref;
+  bool hasName, hasAlias, hasRetval;
+  int depth, ret, id;
+
+  hasName = hasAlias = hasRetval = false;
+  while (1 == xmlTextReaderMoveToNextAttribute(reader))
+  {
+    attribute = (const char*)xmlTextReaderConstName(reader);
+    const char* value = (const char*)xmlTextReaderConstValue(reader);
+    if (attribute == "name")
+    {
+      name = value;
+      hasName = true;
+    }
+    else if (attribute == "alias")
+    {
+      alias = value;
+      hasAlias = true;
+    }
+    else if (attribute == "retval")
     {
-      triggerId = xmlGetProp(cur, (xmlChar*)"id");
-      triggerClass = xmlGetProp(cur, (xmlChar*)"class");
+      row.retval = value;
+      hasRetval = true;
+    }
+    else if (attribute == "errno")
+      row.errnoValue = value;
+    else if (attribute == "calloriginal")
+      row.callOriginal = value;
+    else if (attribute == "argc")
+      row.argc = value;
+  }
+  xmlTextReaderMoveToElement(reader);
 
-      if (triggerId && triggerClass)
+  if (!xmlTextReaderIsEmptyElement(reader))
+  {
+    depth = xmlTextReaderDepth(reader);
+    while (1 == (ret = xmlTextReaderRead(reader)))
+    {
+      if (xmlTextReaderDepth(reader) == depth)
+        break;
+      if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT ||
+          xmlTextReaderDepth(reader) != depth + 1 ||
+          0 != xmlStrcmp(xmlTextReaderConstName(reader), (const xmlChar*)"triggerx"))
+        continue;
+      ref = xmlTextReaderGetAttribute(reader, (const xmlChar*)"ref");
+      if (ref)
       {
-        out << "struct TriggerDesc trigger_" << triggerId << " = { \"" << triggerId << "\", ";
-        out << "\"" << triggerClass << "\", NULL, ";
-
-        xmlFree(triggerId);
-        xmlFree(triggerClass);
-
-        cur = cur->children;
-        while (cur && xmlStrcmp(cur->name, (const xmlChar *)"args"))
-        {
-          cur = cur->next;
-        }
-        if (cur)
-        {
-          out << "\"";
-          print_element_names(cur, out);
-          out << "\"";
-        } else {
-          out << "\"\"";
-        }
-        out << " };" << endl;
+        row.refs.push_back((char*)ref);
+        xmlFree(ref);
       }
     }
+    if (ret != 1)
+      return -1;
   }
+
+  if (!hasName)
+    return 0;
+
+  /* the id and the stub come from the first occurrence of a name */
+  unordered_map<string, int>::iterator it = plan.functionIds.find(name);
+  if (it == plan.functionIds.end())
+  {
+    id = plan.functions.size();
+    plan.functionIds[name] = id;
+    plan.functions.push_back(plan_function_decl());
+    plan.functions[id].name = name;
+    plan.functions[id].symbol = hasAlias ? alias : name;
+  }
+  else
+    id = it->second;
+
+  /* a row needs a return value, the others are left out everywhere */
+  if (hasRetval)
+    plan.functions[id].rows.push_back(row);
+  return 0;
 }
 
-static void
-print_function(xmlNodePtr fn, int triggerListId, ofstream& out)
+/************************************************************************/
+/*  int read_plan(char* config, plan_decl& plan)                        */
+/*                                                                      */
+/*  Reads every <trigger> and <function> element of config, wherever    */
+/*  they are, streaming: the document is never built, so the time and   */
+/*  memory this takes grow linearly with the plan                       */
+/************************************************************************/
+static int
+read_plan(char* config, plan_decl& plan)
 {
-  const char defErrno[] = "0";
-  const char defCallOriginal[] = "0";
-  const char defArgc[] = "0";
-
-  xmlChar* functionName, *return_value,
-    *errno_value, *call_original, *argc;
+  xmlTextReaderPtr reader;
+  const xmlChar* name;
+  int ret;
 
-  functionName = xmlGetProp(fn, (xmlChar*)"name");
-  errno_value = xmlGetProp(fn, (xmlChar*)"errno");
-  return_value = xmlGetProp(fn, (xmlChar*)"retval");
-  call_original = xmlGetProp(fn, (xmlChar*)"calloriginal");
-  argc = xmlGetProp(fn, (xmlChar*)"argc");
+  reader = xmlReaderForFile(config, NULL, 0);
+  if (reader == NULL) {
+    cerr << "Unable to open " << config << endl;
+    return -1;
+  }
 
-  if (functionName && return_value)
+  ret = xmlTextReaderRead(reader);
+  while (1 == ret)
   {
-    out << "\t{ \"" << functionName << "\", ";
-    out << return_value << ", ";
-    out << (errno_value ? (char*)errno_value : defErrno) << ", ";
-    out << (call_original ? (char*)call_original : defCallOriginal) << ", ";
-    out << (argc ? (char*)argc : defArgc) << ", ";
-    out << "triggerList_" << triggerListId;
-    out << " }," << endl;
+    name = xmlTextReaderConstName(reader);
+    if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT &&
+        0 == xmlStrcmp(name, (const xmlChar*)"trigger"))
+    {
+      if (0 != read_trigger(reader, plan))
+        ret = -1;
+      else
+        ret = xmlTextReaderNext(reader);
+    }
+    else if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT &&
+             0 == xmlStrcmp(name, (const xmlChar*)"function"))
+    {
+      if (0 != read_function(reader, plan))
+        ret = -1;
+      else
+        ret = xmlTextReaderRead(reader);
+    }
+    else
+      ret = xmlTextReaderRead(reader);
   }
+  xmlFreeTextReader(reader);
 
-  if (functionName)
-    xmlFree(functionName);
-  if (errno_value)
-    xmlFree(errno_value);
-  if (return_value)
-    xmlFree(return_value);
-  if (call_original)
-    xmlFree(call_original);
-  if (argc)
-    xmlFree(argc);
+  if (ret != 0) {
+    cerr << "Unable to parse " << config << endl;
+    return -1;
+  }
+  return 0;
 }
 
 static void
-print_trigger_list(xmlNodePtr fn, int triggerListId, ofstream& out)
+print_triggers(plan_decl& plan, ofstream& out)
 {
-  xmlNodePtr cur;
-  xmlChar *triggerId;
-
-  cur = fn->children;
-  out << "TriggerDesc* triggerList_" << triggerListId << "[] = { ";
+  vector<arg_node>* argNodes;
+  string triggerId;
+  int i, j;
 
-  while (cur)
+  for (i = 0; i < (int)plan.triggers.size(); ++i)
   {
-    if (cur->type == XML_ELEMENT_NODE &&
-        0 == xmlStrcmp(cur->name, (const xmlChar *)"triggerx"))
+    if (plan.triggers[i].tclass.empty())
+      continue;
+    triggerId = plan.triggers[i].id;
+    argNodes = &plan.triggers[i].args;
+
+    if (plan.triggers[i].hasArgs)
     {
-      triggerId = xmlGetProp(cur, (xmlChar*)"ref");
-      if (triggerId)
+      out << "const TriggerArg args_" << triggerId << "[] = {" << endl;
+      for (j = 0; j < (int)argNodes->size(); ++j)
       {
-        out << "&trigger_" << triggerId << ", ";
-        xmlFree(triggerId);
+        arg_node& arg = (*argNodes)[j];
+        out << "\t{ " << c_string(arg.name) << ", " << c_string(arg.text) << ", ";
+        out << arg.value << "L, ";
+        if (arg.children >= 0)
+          out << "&args_" << triggerId << "[" << arg.children << "], ";
+        else
+          out << "NULL, ";
+        if (arg.next >= 0)
+          out << "&args_" << triggerId << "[" << arg.next << "] }," << endl;
+        else
+          out << "NULL }," << endl;
       }
+      out << "};" << endl;
     }
-    cur = cur->next;
+
+    out << "struct TriggerDesc trigger_" << triggerId << " = { \"" << triggerId << "\", ";
+    out << "\"" << plan.triggers[i].tclass << "\", NULL, ";
+    if (plan.triggers[i].hasArgs)
+      out << "args_" << triggerId;
+    else
+      out << "NULL";
+    out << " };" << endl;
+  }
+}
+
+static void
+print_function(plan_function_decl& fn, plan_row_decl& row, int triggerListId, ofstream& out)
+{
+  out << "\t{ LFI_FN_" << fn.name << ", ";
+  out << row.retval << ", ";
+  out << (row.errnoValue.empty() ? "0" : row.errnoValue) << ", ";
+  out << (row.callOriginal.empty() ? "0" : row.callOriginal) << ", ";
+  out << (row.argc.empty() ? "0" : row.argc) << ", ";
+  out << "triggerList_" << triggerListId;
+  out << " }," << endl;
+}
+
+static void
+print_trigger_list(plan_row_decl& row, int triggerListId, set<string>& triggersUsed, ofstream& out)
+{
+  int i;
+
+  out << "TriggerDesc* triggerList_" << triggerListId << "[] = { ";
+  for (i = 0; i < (int)row.refs.size(); ++i)
+  {
+    out << "&trigger_" << row.refs[i] << ", ";
+    triggersUsed.insert(row.refs[i]);
   }
   out << "NULL };" << endl;
 }
 
+/************************************************************************/
+/*  print_function_ids - assigns each intercepted function a compile-   */
+/*  time id (LFI_FN_<name>), in order of first appearance in the plan,  */
+/*  and emits the id -> name table used by the runtime and triggers     */
+/************************************************************************/
 static void
-print_stubs(xmlNodeSetPtr nodes, ofstream& out)
+print_function_ids(plan_decl& plan, ofstream& out)
 {
-  xmlNodePtr cur;
-  xmlChar *functionName;
-  xmlChar *functionName2;
-  int size;
-  int i, j, triggerListId, triggerListIdBase;
-  set<string> functionsUsed;
+  int i;
+
+  out << "enum lfi_function_id {" << endl;
+  for (i = 0; i < (int)plan.functions.size(); ++i)
+    out << "\tLFI_FN_" << plan.functions[i].name << "," << endl;
+  out << "\tLFI_FN_COUNT" << endl;
+  out << "};" << endl;
+
+  out << "const char* const lfi_function_names[] = { ";
+  for (i = 0; i < (int)plan.functions.size(); ++i)
+    out << "\"" << plan.functions[i].name << "\", ";
+  out << "NULL };" << endl;
+  out << "const char* const lfi_symbol_names[] = { ";
+  for (i = 0; i < (int)plan.functions.size(); ++i)
+    out << "\"" << plan.functions[i].symbol << "\", ";
+  out << "NULL };" << endl;
+  out << "const int lfi_function_count = LFI_FN_COUNT;" << endl;
+  out << "void* lfi_original[LFI_ORIGINAL_TABLE_LENGTH(LFI_FN_COUNT)] __attribute__ ((aligned (LFI_PAGE_SIZE)));" << endl;
+  out << "volatile unsigned long lfi_armed[LFI_FN_COUNT];" << endl;
+  out << "unsigned long lfi_rows_armed[LFI_FN_COUNT];" << endl;
+  out << "volatile unsigned long lfi_call_counts[LFI_FN_COUNT];" << endl << endl;
+}
 
-  size = (nodes) ? nodes->nodeNr : 0;
+static void
+print_stubs(plan_decl& plan, set<string>& triggersUsed, ofstream& out)
+{
+  int i, row, triggerListId, triggerListIdBase;
 
   triggerListId = 1;
-  for(i = 0; i < size; ++i)
+  for (i = 0; i < (int)plan.functions.size(); ++i)
   {
-    assert(nodes->nodeTab[i]);
+    plan_function_decl& fn = plan.functions[i];
+
+    triggerListIdBase = triggerListId;
+    for (row = 0; row < (int)fn.rows.size(); ++row)
+      print_trigger_list(fn.rows[row], triggerListId++, triggersUsed, out);
+
+    out << "struct fninfov2 function_info_" << fn.name << "[] = {\n";
+    triggerListId = triggerListIdBase;
+    for (row = 0; row < (int)fn.rows.size(); ++row)
+      print_function(fn, fn.rows[row], triggerListId++, out);
+    out << "\t{ -1, 0, 0, 0, 0, NULL }" << endl;
+    out << "};\n";
+  }
 
-    if(nodes->nodeTab[i]->type == XML_ELEMENT_NODE)
-    {
-      cur = nodes->nodeTab[i];
-      functionName = xmlGetProp(cur, (xmlChar*)"name");
-      if (!functionName || functionsUsed.find((char*)functionName) != functionsUsed.end())
-        continue;
+  /* same order as the LFI_FN_<name> ids (see print_function_ids) */
+  out << "struct fninfov2* lfi_function_info[] = { ";
+  for (i = 0; i < (int)plan.functions.size(); ++i)
+    out << "function_info_" << plan.functions[i].name << ", ";
+  out << "NULL };" << endl;
+
+  ofstream symbols(experiment_path("symbols").c_str());
+  out << "extern \"C\" {" << endl;
+  /* LFI_FN_<name>, stubs are generated in id order */
+  for (i = 0; i < (int)plan.functions.size(); ++i)
+  {
+    plan_function_decl& fn = plan.functions[i];
+
+    out << "#if defined(__x86_64__) && !defined(__APPLE__) && !defined(LFI_INLINE_ASM_STUBS)" << endl;
+    out << "GENERATE_TRAMPOLINE_x64(" << fn.name << ", " << fn.symbol << ", " << i << ")" << endl;
+    out << "#elif defined(__x86_64__)" << endl;
+    out << "GENERATE_STUB_x64(" << fn.name << ", " << fn.symbol << ")" << endl;
+    symbols << "_" << fn.symbol << endl;
+    out << "#else" << endl;
+    out << "GENERATE_STUBv2(" << fn.name << ")" << endl;
+    out << "#endif" << endl << endl;
+  }
+  out << "}" << endl;
+}
 
-      functionsUsed.insert((char*)functionName);
 
-      triggerListIdBase = triggerListId;
-      print_trigger_list(cur, triggerListId++, out);
-      for(j = i+1; j < size; ++j)
-      {
-        assert(nodes->nodeTab[j]);
-        if(nodes->nodeTab[j]->type == XML_ELEMENT_NODE)
-        {
-          cur = nodes->nodeTab[j];
-          functionName2 = xmlGetProp(cur, (xmlChar*)"name");
-          if (functionName2)
-          {
-            if (0 == strcmp((char*)functionName, (char*)functionName2))
-            {
-              print_trigger_list(cur, triggerListId++, out);
-            }
-            xmlFree(functionName2);
-          }
-        }
-      }
+/************************************************************************/
+/*  print_trigger_table - emits lfi_triggers, the triggers referenced   */
+/*  by at least one function. The stub library instantiates and         */
+/*  initializes all of them once, when it is loaded                     */
+/************************************************************************/
+static void
+print_trigger_table(plan_decl& plan, set<string>& triggersUsed, ofstream& out)
+{
+  int i;
 
-      out << "struct fninfov2 function_info_" << functionName << "[] = {\n";
+  out << "TriggerDesc* lfi_triggers[] = { ";
+  for (i = 0; i < (int)plan.triggers.size(); ++i)
+    if (triggersUsed.find(plan.triggers[i].id) != triggersUsed.end())
+      out << "&trigger_" << plan.triggers[i].id << ", ";
+  out << "NULL };" << endl;
+}
 
-      triggerListId = triggerListIdBase;
+/************************************************************************/
+/*  specialized_type - the LfiRow element (see specialized.h) for the   */
+/*  trigger trig, adding the trigger header it needs to headers         */
+/************************************************************************/
+static string
+specialized_type(plan_trigger_decl& trig, set<string>& headers)
+{
+  ostringstream counts;
+  bool perThread;
+  int cur;
 
-      cur = nodes->nodeTab[i];
-      print_function(cur, triggerListId++, out);
-      for(j = i+1; j < size; ++j)
-      {
-        assert(nodes->nodeTab[j]);
-        if(nodes->nodeTab[j]->type == XML_ELEMENT_NODE)
-        {
-          cur = nodes->nodeTab[j];
-          functionName2 = xmlGetProp(cur, (xmlChar*)"name");
-          if (functionName2)
-          {
-            if (0 == strcmp((char*)functionName, (char*)functionName2))
-            {
-              print_function(cur, triggerListId++, out);
-            }
-            xmlFree(functionName2);
-          }
-        }
-      }
+  if (trig.tclass.empty())
+    return "LfiVirtual";
 
-      out << "\t{ \"\", 0, 0, 0, 0, NULL }" << endl;
-      out << "};\n";
+  if (trig.tclass == "SingleTrigger")
+    return "LfiSingle";
 
-      xmlFree(functionName);
+  if (trig.tclass == "CallCountTrigger")
+  {
+    perThread = false;
+    for (cur = trig.hasArgs ? trig.args[0].children : -1; cur >= 0; cur = trig.args[cur].next)
+    {
+      if (trig.args[cur].name == "perthread")
+        perThread = true;
+      else if (trig.args[cur].name == "callcount" && !trig.args[cur].text.empty())
+        counts << (counts.tellp() ? ", " : "") << atoi(trig.args[cur].text.c_str());
     }
+    /* the per-thread counter lives in the trigger, nothing to fold in */
+    if (!perThread)
+      return "LfiCallCount<" + counts.str() + ">";
+    return "LfiDirect<CallCountTrigger>";
   }
-  ofstream symbols("symbols");
-  out << "extern \"C\" {" << endl;
-  set<string> generated_stubs;
-  for(i = 0; i < size; ++i)
+
+  /* classes without a header of their own (or out of tree) stay virtual */
+  if (0 != access(("triggers/" + trig.tclass + ".h").c_str(), R_OK))
+    return "LfiVirtual";
+  headers.insert(trig.tclass);
+  return "LfiDirect<" + trig.tclass + ">";
+}
+
+/************************************************************************/
+/*  print_specialized - emits lfi_specialized, with one decision        */
+/*  function per intercepted function in specialized mode (-s), all     */
+/*  NULL otherwise. The rows and triggerList_<n> are numbered like in   */
+/*  print_stubs                                                         */
+/************************************************************************/
+static void
+print_specialized(plan_decl& plan, ofstream& out)
+{
+  unordered_map<string, int>::iterator trig;
+  set<string> headers;
+  ostringstream decide;
+  string types;
+  int i, j, row, triggerListId;
+
+  if (!specialized)
+  {
+    out << "const lfi_decide_fn lfi_specialized[LFI_FN_COUNT + 1] = { NULL };" << endl;
+    return;
+  }
+
+  triggerListId = 1;
+  for (i = 0; i < (int)plan.functions.size(); ++i)
   {
-    assert(nodes->nodeTab[i]);
+    plan_function_decl& fn = plan.functions[i];
 
-    if(nodes->nodeTab[i]->type == XML_ELEMENT_NODE)
+    decide << "static int lfi_decide_" << fn.name << "(const CallContext& ctx)" << endl;
+    decide << "{" << endl;
+    for (row = 0; row < (int)fn.rows.size(); ++row, ++triggerListId)
     {
-      cur = nodes->nodeTab[i];         
-      functionName = xmlGetProp(cur, (xmlChar*)"name");
-      if (functionName && generated_stubs.end() == generated_stubs.find((char*)functionName))
+      types = "";
+      for (j = 0; j < (int)fn.rows[row].refs.size(); ++j)
       {
-        xmlChar* aliasName = xmlGetProp(cur, (xmlChar*)"alias");
-        out << "#ifdef __x86_64__" << endl;
-        if (aliasName) {
-          out << "GENERATE_STUB_x64(" << (char*)functionName << ", " << (char*)aliasName << ")" << endl;
-          symbols << "_" << aliasName << endl;
-        } else {
-          out << "GENERATE_STUB_x64(" << (char*)functionName << ", " << (char*)functionName << ")" << endl;
-          symbols << "_" << functionName << endl;
-        }
-        out << "#else" << endl;
-        out << "GENERATE_STUBv2(" << (char*)functionName << ")" << endl;
-        out << "#endif" << endl << endl;
-        generated_stubs.insert((char*)functionName);
-        xmlFree(functionName);
-        if (aliasName)
-          xmlFree(aliasName);
+        if (!types.empty())
+          types += ", ";
+        /* an undefined trigger doesn't compile in table mode either */
+        trig = plan.triggerIds.find(fn.rows[row].refs[j]);
+        types += trig != plan.triggerIds.end() ? specialized_type(plan.triggers[trig->second], headers) : "LfiVirtual";
       }
+      decide << "  LFI_SPECIALIZED_ROW(LFI_FN_" << fn.name << ", " << row
+             << ", triggerList_" << triggerListId << (types.empty() ? "" : ", ") << types << ")" << endl;
     }
+    decide << "  return -1;" << endl;
+    decide << "}" << endl << endl;
   }
-  out << "}" << endl;
+
+  out << endl << "#include \"specialized.h\"" << endl;
+  for (set<string>::iterator it = headers.begin(); it != headers.end(); ++it)
+    out << "#include \"triggers/" << *it << ".h\"" << endl;
+  out << endl << decide.str();
+
+  out << "const lfi_decide_fn lfi_specialized[LFI_FN_COUNT + 1] = { ";
+  for (i = 0; i < (int)plan.functions.size(); ++i)
+    out << "lfi_decide_" << plan.functions[i].name << ", ";
+  out << "NULL };" << endl;
 }
 
+/*
+   built once by make (see the Makefile), it holds everything but the
+   generated stub file
+*/
+#define TRIGGERSLIB  "liblfi_triggers.a"
+
+/* the command compile_file runs (also part of the cache key) */
+static void compile_command(const char* cfile, const char* outfile, char* cmd)
+{
+#if defined(__x86_64__) && !defined(__APPLE__)
+  /*
+     the assembly trampolines don't depend on the code the compiler
+     generates, so only the stub file is compiled, with optimizations;
+     frame pointers are kept for CallContext::FramePointer
+  */
+  if (0 == access(TRIGGERSLIB, R_OK))
+  {
+    sprintf(cmd, "g++ -g -O2 -fno-omit-frame-pointer -I. -o %s %s -Wl,--whole-archive %s -Wl,--no-whole-archive -shared -fPIC -lrt -ldl", outfile, cfile, TRIGGERSLIB);
+    return;
+  }
+#endif
+  /* the inline assembly stubs expect the prologue of -O0 code */
+#ifdef __APPLE__
+  sprintf(cmd, "g++  -g -I. -o %s %s inter.cpp logring.cpp replaylog.cpp resolve.cpp control.cpp forkserver.cpp linetable.cpp trampoline_x64.S Trigger.cpp triggers/*.cpp -O0 -shared -Xlinker -exported_symbols_list -Xlinker %s", outfile, cfile, experiment_path("symbols").c_str());
+#else
+  sprintf(cmd, "g++ -g -I. -o %s %s inter.cpp logring.cpp replaylog.cpp resolve.cpp control.cpp forkserver.cpp linetable.cpp trampoline_x64.S Trigger.cpp triggers/*.cpp -O0 -shared -fPIC -lrt -ldl", outfile, cfile);
+#endif
+  // use the following line instead if you need debug information support (after installing libelf, libdwarf and the appropriate trigger)
+  //sprintf(cmd, "g++ -g -o %s %s inter.cpp logring.cpp replaylog.cpp resolve.cpp control.cpp forkserver.cpp linetable.cpp trampoline_x64.S Trigger.cpp triggers/*.cpp -O0 -shared -fPIC -lrt -ldl -ldwarf -lelf", outfile, cfile);
+}
 
 /************************************************************************/
-/*  int compile_file(char* cfile, char* outfile)                        */
+/*  int compile_file(const char* cfile, const char* outfile)            */
 /*                                                                      */
 /*  Compiles cfile (dynamically generated) along with its dependencies  */
 /*  to outfile as a shared object using appropriate flags               */
 /************************************************************************/
-int compile_file(char* cfile, char* outfile)
+int compile_file(const char* cfile, const char* outfile)
 {
   char cmd[1024];
   int status;
-#ifdef __APPLE__
-  sprintf(cmd, "g++  -g -o %s %s inter.cpp Trigger.cpp triggers/*.cpp `xml2-config --cflags` `xml2-config --libs` -O0 -shared -Xlinker -exported_symbols_list -Xlinker symbols", outfile, cfile);
-#else
-  sprintf(cmd, "g++ -g -o %s %s inter.cpp Trigger.cpp triggers/*.cpp `xml2-config --cflags` `xml2-config --libs` -O0 -shared -fPIC -lrt -ldl", outfile, cfile);
-#endif
-  // use the following line instead if you need debug information support (after installing libelf, libdwarf and the appropriate trigger)
-  //sprintf(cmd, "g++ -g -o %s %s inter.cpp Trigger.cpp triggers/*.cpp `xml2-config --cflags` `xml2-config --libs` -O0 -shared -fPIC -lrt -ldl -ldwarf -lelf", outfile, cfile);
+
+  compile_command(cfile, outfile, cmd);
 
   cerr << "Compiling stub library " << outfile << " from " << cfile << endl;
   cerr << cmd << " ..." << endl;
@@ -371,133 +748,763 @@ int compile_file(char* cfile, char* outfile)
   return 0;
 }
 
-int generate_stub(char* config)
+/************************************************************************/
+/*  compiled stub cache: a stub library is stored under                 */
+/*  $LFI_CACHE/<key> (default lfi-cache, empty to disable), where the   */
+/*  key hashes the generated stub file (i.e. the plan, normalized by    */
+/*  the generator), the compile command and the runtime sources. The    */
+/*  entry keeps a copy of the stub file, so that a hash collision is    */
+/*  a miss and not the library of another plan                          */
+/************************************************************************/
+#define CACHE_ENV      "LFI_CACHE"
+#define CACHE_DEFAULT  "lfi-cache"
+
+/* the runtime sources the stub library is built from (see compile_command) */
+static const char* const cache_sources[] = {
+  "*.h", "*.cpp", "*.S", "triggers/*.h", "triggers/*.cpp", TRIGGERSLIB, NULL
+};
+
+/* FNV-1a, like the symbol table of resolve.cpp */
+static uint64_t hash_bytes(uint64_t h, const char* data, size_t size)
 {
-  xmlDocPtr doc;
-  xmlXPathContextPtr xpathCtx;
-  xmlXPathObjectPtr xpathObjTriggers;
-  xmlXPathObjectPtr xpathObj;
-  xmlChar *xpathExpr = (xmlChar*)"//function";
-  xmlChar *xpathExprTriggers = (xmlChar*)"//trigger";
+  while (size--)
+    h = (h ^ (unsigned char)*data++) * 1099511628211ULL;
+  return h;
+}
 
-  cerr << "Generating stub file " << STUBC << " from " << config << endl;
+static int read_file(const char* path, string& content)
+{
+  ifstream in(path, ios::in | ios::binary);
+  ostringstream buffer;
 
-  /* Print results */
-  ofstream outf(STUBC);
+  if (!in)
+    return -1;
+  buffer << in.rdbuf();
+  content = buffer.str();
+  return 0;
+}
 
-  outf << "#include \"inter.h\"" << endl;
-  outf << "STUB_VAR_DECL" << endl << endl;
+static int copy_file(const char* from, const char* to)
+{
+  string content, tmp;
+  char suffix[32];
 
-  doc = xmlParseFile(config);
-  if (doc == NULL) {
-    cerr << "Unable to open " << config << endl;
+  if (read_file(from, content))
     return -1;
+  /* renamed into place, so that concurrent runs never see half a file */
+  sprintf(suffix, ".%d.tmp", (int)getpid());
+  tmp = string(to) + suffix;
+  {
+    ofstream out(tmp.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!out || !out.write(content.data(), content.size()) || !out.flush())
+    {
+      unlink(tmp.c_str());
+      return -1;
+    }
   }
-
-  xpathCtx = xmlXPathNewContext(doc);
-  if(xpathCtx == NULL) {
-    cerr << "Error: unable to create new XPath context" << endl;
-    xmlFreeDoc(doc); 
-    return(-1);
+  chmod(tmp.c_str(), 0755);
+  if (rename(tmp.c_str(), to))
+  {
+    unlink(tmp.c_str());
+    return -1;
   }
+  return 0;
+}
 
-  xpathObjTriggers = xmlXPathEvalExpression(xpathExprTriggers, xpathCtx);
-  if(xpathObjTriggers == NULL) {
-    cerr << "Error: unable to evaluate xpath expression \"" << xpathExprTriggers << "\"" << endl;
-    xmlXPathFreeContext(xpathCtx); 
-    xmlFreeDoc(doc); 
-    return(-1);
+static uint64_t cache_key(const string& stub)
+{
+  char cmd[1024];
+  string content;
+  glob_t files;
+  uint64_t h;
+  size_t i;
+  int p;
+
+  /* the same key wherever the experiment writes its stub */
+  compile_command(STUBC, STUBEX, cmd);
+  h = hash_bytes(14695981039346656037ULL, stub.data(), stub.size());
+  h = hash_bytes(h, cmd, strlen(cmd) + 1);
+  for (p = 0; cache_sources[p]; ++p)
+  {
+    if (glob(cache_sources[p], 0, NULL, &files))
+      continue;
+    for (i = 0; i < files.gl_pathc; ++i)
+    {
+      if (0 == strcmp(files.gl_pathv[i], STUBC) || read_file(files.gl_pathv[i], content))
+        continue;
+      h = hash_bytes(h, files.gl_pathv[i], strlen(files.gl_pathv[i]) + 1);
+      h = hash_bytes(h, content.data(), content.size());
+    }
+    globfree(&files);
   }
+  return h;
+}
 
-  xpathObj = xmlXPathEvalExpression(xpathExpr, xpathCtx);
-  if(xpathObj == NULL) {
-    cerr << "Error: unable to evaluate xpath expression \"" << xpathExpr << "\"" << endl;
-    xmlXPathFreeContext(xpathCtx); 
-    xmlFreeDoc(doc); 
-    return(-1);
+/************************************************************************/
+/*  int compile_cached(const char* cfile, const char* outfile)          */
+/*                                                                      */
+/*  Like compile_file, but copies outfile from the cache when cfile     */
+/*  was already compiled with the same flags and sources                */
+/************************************************************************/
+int compile_cached(const char* cfile, const char* outfile)
+{
+  const char* dir;
+  char key[32];
+  string stub, cached, entry;
+
+  dir = getenv(CACHE_ENV);
+  if (!dir)
+    dir = CACHE_DEFAULT;
+  if (!*dir || read_file(cfile, stub))
+    return compile_file(cfile, outfile);
+
+  sprintf(key, "%016llx", (unsigned long long)cache_key(stub));
+  entry = string(dir) + "/" + key;
+  if (0 == read_file((entry + "/" + STUBC).c_str(), cached) && cached == stub &&
+      0 == copy_file((entry + "/" + STUBEX).c_str(), outfile))
+  {
+    cerr << "Using cached stub library " << entry << "/" << STUBEX << endl;
+    return 0;
   }
 
-  print_triggers(xpathObjTriggers->nodesetval, outf);
-  print_stubs(xpathObj->nodesetval, outf);
+  if (compile_file(cfile, outfile))
+    return -1;
+  if ((mkdir(dir, 0755) && EEXIST != errno) || (mkdir(entry.c_str(), 0755) && EEXIST != errno) ||
+      copy_file(outfile, (entry + "/" + STUBEX).c_str()) ||
+      copy_file(cfile, (entry + "/" + STUBC).c_str()))
+    cerr << "Unable to cache the stub library in " << entry << endl;
+  return 0;
+}
+
+/************************************************************************/
+/*  compiled plan for the prebuilt runtime (see planfile.h)             */
+/************************************************************************/
 
-  /* Cleanup */
-  xmlXPathFreeObject(xpathObj);
-  xmlXPathFreeObject(xpathObjTriggers);
-  xmlXPathFreeContext(xpathCtx);
-  xmlFreeDoc(doc);
+/* retval, errno, ...: a number, an errno name (EINVAL) or NULL */
+static int parse_value(const char* text, int* value)
+{
+  const char* name;
+  char* end;
+  int e;
 
-  return compile_file(STUBC, STUBEX);
+  if (0 == strcmp(text, "NULL"))
+  {
+    *value = 0;
+    return 0;
+  }
+  *value = (int)strtol(text, &end, 0);
+  if (end != text && !*end)
+    return 0;
+  for (e = 1; e < 4096; ++e)
+  {
+    name = strerrorname_np(e);
+    if (name && 0 == strcmp(name, text))
+    {
+      *value = e;
+      return 0;
+    }
+  }
+  cerr << "Can't evaluate \"" << text << "\" without compiling the plan" << endl;
+  return -1;
 }
 
-/***************************************************************************/
-/*  run_subject(int argc, char** argv,                                 */
-/*              char* preload_library, char *envp[])                       */
-/*                                                                         */
-/*  Runs subject program defined by (argc, argv[]) in the parent's     */
-/*        (our) environment + LD_PRELOAD                                   */
-/*                                                                         */
-/*  Returns:                                                           */
-/*    -1 - failed to start program                               */
-/*    0  - child program exited normally with a 0 return code    */
-/*    FAILURE_METRIC - child program exited normally with a non 0  */
-/*                                                     return code         */
-/*    CRASH_METRIC - child program was terminated by a signal    */
-/***************************************************************************/
-int run_subject(int argc, char** argv, char* preload_library, char *envp[])
+static int parse_attribute(const string& text, int* value)
 {
-#ifdef __APPLE__
-  const char *preload = "DYLD_INSERT_LIBRARIES";
-  const char *apple_env_flat = "DYLD_FORCE_FLAT_NAMESPACE";
-  const char *apple_no_dyldcache = "DYLD_SHARED_REGION";
-  /* this needs to be specified explictly in the flat namespace */
-  const char *apple_explicit_libs = "/System/Library/Frameworks/ApplicationServices.framework/Versions/A/Frameworks/ATS.framework/Versions/A/Resources/libFontRegistry.dylib";
-#else
-  const char *preload = "LD_PRELOAD";
-#endif
-  char preload_path[1024];
-
-  char **newarg;
+  if (text.empty())
+  {
+    *value = 0;
+    return 0;
+  }
+  return parse_value(text.c_str(), value);
+}
+
+/* offset of s in the string table, each string is stored once */
+static uint32_t plan_string(string& strings, map<string, uint32_t>& offsets, const string& s)
+{
+  map<string, uint32_t>::iterator it;
+
+  it = offsets.find(s);
+  if (it != offsets.end())
+    return it->second;
+  offsets[s] = strings.size();
+  strings.append(s.c_str(), s.size() + 1);
+  return offsets[s];
+}
+
+template <class T>
+static uint32_t plan_table(string& file, const vector<T>& table)
+{
+  uint32_t offset;
+
+  file.resize((file.size() + 7) & ~(size_t)7, '\0');
+  offset = file.size();
+  if (!table.empty())
+    file.append((const char*)&table[0], table.size() * sizeof(T));
+  return offset;
+}
+
+/************************************************************************/
+/*  int compile_plan(char* config, char* planfile)                      */
+/*                                                                      */
+/*  Writes the plan in config to planfile, with the same function ids,  */
+/*  rows and triggers as the stub file generate_stub would write        */
+/************************************************************************/
+int compile_plan(char* config, char* planfile)
+{
+  plan_decl plan;
+  unordered_map<string, int>::iterator it;
+  vector<int> position;
+  vector<struct plan_function> functions;
+  vector<struct plan_row> rows;
+  vector<uint32_t> refs;
+  vector<struct plan_trigger> triggers;
+  vector<struct plan_arg> planArgs;
+  map<string, uint32_t> stringOffsets;
+  string strings, file;
+  struct plan_header header;
+  struct plan_function function;
+  struct plan_row row;
+  struct plan_trigger trigger;
+  struct plan_arg arg;
+  int i, j, f, t;
+
+  cerr << "Compiling plan " << planfile << " from " << config << endl;
+
+  if (0 != read_plan(config, plan))
+    return -1;
+
+  /*
+     lfi_triggers lists the triggers in use in order of declaration (see
+     print_trigger_table), the rows refer to them by position
+  */
+  position.assign(plan.triggers.size(), -1);
+  for (f = 0; f < (int)plan.functions.size(); ++f)
+    for (i = 0; i < (int)plan.functions[f].rows.size(); ++i)
+      for (j = 0; j < (int)plan.functions[f].rows[i].refs.size(); ++j)
+      {
+        it = plan.triggerIds.find(plan.functions[f].rows[i].refs[j]);
+        if (it == plan.triggerIds.end())
+        {
+          cerr << "Trigger " << plan.functions[f].rows[i].refs[j] << " is not defined" << endl;
+          return -1;
+        }
+        position[it->second] = 0;
+      }
+
+  for (t = 0; t < (int)plan.triggers.size(); ++t)
+  {
+    if (position[t] < 0)
+      continue;
+    plan_trigger_decl& decl = plan.triggers[t];
+    if (decl.tclass.empty())
+    {
+      cerr << "Trigger " << decl.id << " has no class" << endl;
+      return -1;
+    }
+    position[t] = triggers.size();
+    trigger.id = plan_string(strings, stringOffsets, decl.id);
+    trigger.tclass = plan_string(strings, stringOffsets, decl.tclass);
+    trigger.args = -1;
+    trigger.reserved = 0;
+
+    if (decl.hasArgs)
+    {
+      trigger.args = planArgs.size();
+      for (j = 0; j < (int)decl.args.size(); ++j)
+      {
+        arg.name = plan_string(strings, stringOffsets, decl.args[j].name);
+        arg.text = plan_string(strings, stringOffsets, decl.args[j].text);
+        arg.value = decl.args[j].value;
+        arg.children = decl.args[j].children < 0 ? -1 : trigger.args + decl.args[j].children;
+        arg.next = decl.args[j].next < 0 ? -1 : trigger.args + decl.args[j].next;
+        planArgs.push_back(arg);
+      }
+    }
+    triggers.push_back(trigger);
+  }
+
+  /* LFI_FN_<name> in order of first appearance, rows in plan order */
+  for (f = 0; f < (int)plan.functions.size(); ++f)
+  {
+    plan_function_decl& fn = plan.functions[f];
+
+    function.name = plan_string(strings, stringOffsets, fn.name);
+    function.symbol = plan_string(strings, stringOffsets, fn.symbol);
+    function.first_row = rows.size();
+    function.row_count = fn.rows.size();
+    functions.push_back(function);
+
+    for (i = 0; i < (int)fn.rows.size(); ++i)
+    {
+      if (parse_attribute(fn.rows[i].retval, &row.return_value) ||
+          parse_attribute(fn.rows[i].errnoValue, &row.errno_value) ||
+          parse_attribute(fn.rows[i].callOriginal, &row.call_original) ||
+          parse_attribute(fn.rows[i].argc, &row.argc))
+        return -1;
+      row.first_ref = refs.size();
+      for (j = 0; j < (int)fn.rows[i].refs.size(); ++j)
+        refs.push_back(position[plan.triggerIds[fn.rows[i].refs[j]]]);
+      row.ref_count = refs.size() - row.first_ref;
+      rows.push_back(row);
+    }
+  }
+
+  memset(&header, 0, sizeof(header));
+  file.assign((const char*)&header, sizeof(header));
+  memcpy(header.magic, PLAN_MAGIC, sizeof(header.magic));
+  header.version = PLAN_VERSION;
+  header.function_count = functions.size();
+  header.row_count = rows.size();
+  header.ref_count = refs.size();
+  header.trigger_count = triggers.size();
+  header.arg_count = planArgs.size();
+  header.strings_size = strings.size();
+  header.functions = plan_table(file, functions);
+  header.rows = plan_table(file, rows);
+  header.refs = plan_table(file, refs);
+  header.triggers = plan_table(file, triggers);
+  header.args = plan_table(file, planArgs);
+  header.strings = file.size();
+  file += strings;
+  header.size = file.size();
+  file.replace(0, sizeof(header), (const char*)&header, sizeof(header));
+
+  ofstream out(planfile, ios::out | ios::binary | ios::trunc);
+  if (!(out && out.write(file.data(), file.size()) && out.flush()))
+  {
+    cerr << "Unable to write " << planfile << endl;
+    return -1;
+  }
+  return 0;
+}
+
+int generate_stub(char* config)
+{
+  plan_decl plan;
+  set<string> triggersUsed;
+
+  cerr << "Generating stub file " << experiment_path(STUBC) << " from " << config << endl;
+
+  if (0 != read_plan(config, plan))
+    return -1;
+
+  /* Print results */
+  ofstream outf(experiment_path(STUBC).c_str());
+
+  outf << "#include \"inter.h\"" << endl;
+  outf << "STUB_VAR_DECL" << endl << endl;
+
+  print_triggers(plan, outf);
+  print_function_ids(plan, outf);
+  print_stubs(plan, triggersUsed, outf);
+  print_trigger_table(plan, triggersUsed, outf);
+  print_specialized(plan, outf);
+  outf.close();
+
+  if (generate_only)
+    return 0;
+  return compile_cached(experiment_path(STUBC).c_str(), experiment_path(STUBEX).c_str());
+}
+
+/************************************************************************/
+/*  watchdog: with -w or -c, a target that runs longer than the wall-   */
+/*  clock or CPU budget is a hang (HANG_METRIC). Its stacks are written */
+/*  to hang.stacks, next to its other files (see watchdog.h), and it is */
+/*  killed                                                              */
+/************************************************************************/
+
+/* the CPU time pid used so far (s), -1 if unknown */
+static double cpu_time(pid_t pid)
+{
+#ifdef __linux__
+  unsigned long utime, stime;
+  char path[64], buffer[1024];
+  char *fields;
+  int fd, n;
+
+  sprintf(path, "/proc/%d/stat", (int)pid);
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  n = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if (n <= 0)
+    return -1;
+  buffer[n] = 0;
+  /* the command name may contain anything, the fields follow its ')' */
+  if (!(fields = strrchr(buffer, ')')) ||
+      2 != sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime))
+    return -1;
+  return (utime + stime) / (double)sysconf(_SC_CLK_TCK);
+#else
+  return -1;
+#endif
+}
+
+static double elapsed_since(const struct timeval* start)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+/* nonzero once pid, started at start, is over one of the budgets */
+static int over_budget(pid_t pid, const struct timeval* start)
+{
+  return (wall_budget > 0 && elapsed_since(start) >= wall_budget) ||
+         (cpu_budget > 0 && cpu_time(pid) >= cpu_budget);
+}
+
+/* where the stacks of the target go, absolute: it runs in experiment_dir */
+static string stacks_path(void)
+{
+  string path = experiment_path(LFI_STACKS_FILE);
+  char cwd[PATH_MAX];
+
+  if (path[0] == '/' || !getcwd(cwd, sizeof(cwd)))
+    return path;
+  return string(cwd) + "/" + path;
+}
+
+static off_t file_size(const char* path)
+{
+  struct stat st;
+
+  return stat(path, &st) ? 0 : st.st_size;
+}
+
+/* the first line of a file of /proc, "?" if it can't be read */
+static string proc_line(const string& path)
+{
+  string line;
+
+  ifstream in(path.c_str());
+  if (!in || !getline(in, line) || line.empty())
+    return "?";
+  return line;
+}
+
+/* whether stacks, past offset, holds the whole record of thread tid */
+static bool has_stack_record(const string& stacks, off_t offset, pid_t pid, pid_t tid)
+{
+  ostringstream header;
+  string contents;
+  size_t start;
+
+  ifstream in(stacks.c_str());
+  if (!in || !in.seekg(offset))
+    return false;
+  contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+
+  /* "pid <pid> thread <tid>:", the frames, then a blank line */
+  header << "pid " << pid << " thread " << tid << ":\n";
+  start = contents.find(header.str());
+  return start != string::npos &&
+         contents.find("\n\n", start + header.str().size() - 1) != string::npos;
+}
+
+/************************************************************************/
+/*  kill_hung(pid_t pid, const string& stacks)                          */
+/*                                                                      */
+/*  Appends what every thread of pid is waiting for to stacks, asks     */
+/*  each of them for its backtrace (see watchdog.h), then kills pid     */
+/************************************************************************/
+static void kill_hung(pid_t pid, const string& stacks)
+{
+#ifdef LFI_STACKS_SIGNAL
+  char pattern[64];
+  string task;
+  glob_t tasks;
+  off_t size;
+  pid_t tid;
+  size_t i;
+  int tick;
+
+  sprintf(pattern, "/proc/%d/task/*", (int)pid);
+  if (0 == glob(pattern, 0, NULL, &tasks))
+  {
+    /* what each thread waits for, before it's stopped */
+    {
+      ofstream out(stacks.c_str(), ios::out | ios::app);
+      for (i = 0; i < tasks.gl_pathc; ++i)
+      {
+        task = tasks.gl_pathv[i];
+        out << "pid " << pid << " thread " << task.substr(task.find_last_of('/') + 1)
+            << " (" << proc_line(task + "/comm") << ") hung in " << proc_line(task + "/wchan")
+            << ", syscall " << proc_line(task + "/syscall") << endl;
+      }
+      out << endl;
+    }
+
+    /* stopped, the threads stay where they hung between two backtraces */
+    kill(pid, SIGSTOP);
+    for (i = 0; i < tasks.gl_pathc; ++i)
+    {
+      task = tasks.gl_pathv[i];
+      tid = atoi(task.c_str() + task.find_last_of('/') + 1);
+      size = file_size(stacks.c_str());
+      syscall(SYS_tgkill, pid, tid, LFI_STACKS_SIGNAL);
+      /*
+         SIGCONT resumes every thread, not just tid, and other records
+         may still come in: wait for tid's own, which its handler writes
+         at once
+      */
+      kill(pid, SIGCONT);
+      for (tick = 0; tick < 100 && !has_stack_record(stacks, size, pid, tid); ++tick)
+        usleep(1000);
+      kill(pid, SIGSTOP);
+    }
+    globfree(&tasks);
+  }
+#endif
+  kill(pid, SIGKILL);
+}
+
+/************************************************************************/
+/*  int watch_subject(pid_t pid, int* status, struct rusage* usage,     */
+/*                    const string& stacks)                             */
+/*                                                                      */
+/*  Waits for the target like wait4, within the budgets. Returns 1 if   */
+/*  it ran out (it was killed then, see kill_hung), 0 otherwise         */
+/************************************************************************/
+static int watch_subject(pid_t pid, int* status, struct rusage* usage, const string& stacks)
+{
+  struct timeval start;
+  struct timespec tick;
+  sigset_t chld, old;
+  double wait;
+  int hung;
+
+  if (wall_budget <= 0 && cpu_budget <= 0)
+  {
+    while (wait4(pid, status, 0, usage) < 0 && EINTR == errno)
+      ;
+    return 0;
+  }
+
+  /* woken up when the target exits, without polling for it */
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &old);
+  gettimeofday(&start, NULL);
+  for (hung = 0; ; )
+  {
+    if (wait4(pid, status, WNOHANG, usage) == pid)
+      break;
+    if (over_budget(pid, &start))
+    {
+      kill_hung(pid, stacks);
+      while (wait4(pid, status, 0, usage) < 0 && EINTR == errno)
+        ;
+      hung = 1;
+      break;
+    }
+
+    /* the CPU time is checked every 10 ms */
+    wait = cpu_budget > 0 ? 0.01 : wall_budget - elapsed_since(&start);
+    if (wall_budget > 0 && wall_budget - elapsed_since(&start) < wait)
+      wait = wall_budget - elapsed_since(&start);
+    if (wait < 0.001)
+      wait = 0.001;
+    tick.tv_sec = (time_t)wait;
+    tick.tv_nsec = (long)((wait - tick.tv_sec) * 1e9);
+#ifdef __APPLE__
+    nanosleep(&tick, NULL);
+#else
+    sigtimedwait(&chld, NULL, &tick);
+#endif
+  }
+  sigprocmask(SIG_SETMASK, &old, NULL);
+  return hung;
+}
+
+/************************************************************************/
+/*  the control page of a target (control.h) is unlinked by its stub   */
+/*  library when it exits, which a target that crashed, hung or was    */
+/*  killed never does: libfi removes it once it reaped the target. A   */
+/*  page named by $LFI_CONTROL is shared with other processes and kept */
+/************************************************************************/
+static void release_control(pid_t pid)
+{
+  const char* env = getenv(LFI_CONTROL_ENV);
+  char name[64];
+
+  if (env && env[0])
+    return;
+  snprintf(name, sizeof(name), LFI_CONTROL_PREFIX "%d", (int)pid);
+  shm_unlink(name);
+}
+
+/************************************************************************/
+/*  resource usage: what each run of the target cost, from wait4, next  */
+/*  to its score. The columns (USAGE_COLUMNS) end each line of a        */
+/*  campaign's results and make up the file usage of an experiment      */
+/*  directory, so runs with a fault can be compared to one without      */
+/************************************************************************/
+struct run_usage
+{
+  double wall; /* s, < 0 if the target didn't run */
+  struct rusage ru;
+};
+
+#define USAGE_COLUMNS "wall_s\tuser_s\tsys_s\tmaxrss_kb\tminflt\tmajflt\tnvcsw\tnivcsw\tinblock\toublock"
+#define USAGE_COUNT   10
+
+static const struct run_usage no_usage = { -1 };
+
+static double seconds(const struct timeval& tv)
+{
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void print_usage(ostream& out, const struct run_usage& usage)
+{
+  int i;
+
+  if (usage.wall < 0)
+  {
+    for (i = 0; i < USAGE_COUNT; ++i)
+      out << (i ? "\t-" : "-");
+    return;
+  }
+  out << usage.wall << "\t" << seconds(usage.ru.ru_utime) << "\t" << seconds(usage.ru.ru_stime)
+#ifdef __APPLE__
+      << "\t" << usage.ru.ru_maxrss / 1024 /* bytes there */
+#else
+      << "\t" << usage.ru.ru_maxrss
+#endif
+      << "\t" << usage.ru.ru_minflt << "\t" << usage.ru.ru_majflt
+      << "\t" << usage.ru.ru_nvcsw << "\t" << usage.ru.ru_nivcsw
+      << "\t" << usage.ru.ru_inblock << "\t" << usage.ru.ru_oublock;
+}
+
+/* <experiment_dir>usage: the header line, then the run's columns */
+static void write_usage(const struct run_usage& usage)
+{
+  ofstream out(experiment_path("usage").c_str());
+
+  out << "# " << USAGE_COLUMNS << endl;
+  print_usage(out, usage);
+  out << endl;
+}
+
+/* the score of a target that ended with status (from waitpid) */
+static int exit_metric(int status)
+{
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return CRASH_METRIC;
+}
+
+/* the library to preload, libfi's directory/library, in path */
+static int preload_path(const char* library, char* path, size_t size)
+{
+#ifdef __APPLE__
+  /* this needs to be specified explictly in the flat namespace */
+  const char *apple_explicit_libs = "/System/Library/Frameworks/ApplicationServices.framework/Versions/A/Frameworks/ATS.framework/Versions/A/Resources/libFontRegistry.dylib";
+#endif
+
+  if (library[0] == '/')
+  {
+    if (strlen(library) >= size)
+      return -1;
+    strcpy(path, library);
+  }
+  else
+  {
+    if (!getcwd(path, size - strlen(library) - 1))
+      return -1;
+    strcat(path, "/");
+    strcat(path, library);
+  }
+  /* ld.so would ignore it and the target would run without faults */
+  if (0 != access(path, R_OK))
+  {
+    cerr << "No stub library " << path << endl;
+    return -1;
+  }
+#if __APPLE__
+  strlcat(path, ":", size);
+  strlcat(path, apple_explicit_libs, size);
+#endif
+  return 0;
+}
+
+/* in the child, before execv */
+static void set_preload(const char* path)
+{
+#ifdef __APPLE__
+  setenv("DYLD_FORCE_FLAT_NAMESPACE", "", 1);
+  setenv("DYLD_SHARED_REGION", "avoid", 1);
+  setenv("DYLD_INSERT_LIBRARIES", path, 1);
+#else
+  setenv("LD_PRELOAD", path, 1);
+#endif
+}
+
+/***************************************************************************/
+/*  run_subject(int argc, char** argv, const char* preload_library,    */
+/*              char *envp[], struct run_usage* usage)                     */
+/*                                                                         */
+/*  Runs subject program defined by (argc, argv[]) in the parent's     */
+/*        (our) environment + LD_PRELOAD, in experiment_dir                */
+/*  What it cost goes to *usage (if not NULL) and to the usage file    */
+/*        of experiment_dir                                                */
+/*                                                                         */
+/*  Returns:                                                           */
+/*    -1 - failed to start program                               */
+/*    0  - child program exited normally with a 0 return code    */
+/*    FAILURE_METRIC - child program exited normally with a non 0  */
+/*                                                     return code         */
+/*    CRASH_METRIC - child program was terminated by a signal    */
+/*    HANG_METRIC - child program ran out of time (-w, -c) and was killed  */
+/***************************************************************************/
+int run_subject(int argc, char** argv, const char* preload_library, char *envp[],
+                struct run_usage* usage)
+{
+  char preload[1024];
+
+  char **newarg;
   int i, return_value;
-  int fd;
 
   pid_t monitor;
   int status, exit_status, exit_signal;
   struct timeval tvstart, tvend;
+  struct run_usage run;
 
-  key_t key = getpid();
   int* runstatus;
   int shmid = -1;
+  string stacks;
+  int hung;
 
-  if ((shmid = shmget( key, 1024, IPC_CREAT | 0666 )) < 0 )
+  /* private to this run, the child inherits the attachment */
+  if ((shmid = shmget( IPC_PRIVATE, 1024, IPC_CREAT | 0600 )) < 0 )
     perror("shmget");
   if ((runstatus = (int*)shmat( shmid, NULL, 0 )) == (int*) -1)
     perror("shmat");
 
-  return_value = CRASH_METRIC;
-  if (getcwd(preload_path, sizeof(preload_path) - strlen(preload_library) - 1))
+  return_value = -1;
+  run = no_usage;
+  if (0 == preload_path(preload_library, preload, sizeof(preload)))
   {
-    strcat(preload_path, "/");
-    strcat(preload_path, preload_library);
-#if __APPLE__
-    strlcat(preload_path, ":", sizeof(preload_path));
-    strlcat(preload_path, apple_explicit_libs, sizeof(preload_path));
-#endif
-    cerr << "[LFI] Preloading " << preload_path << endl;
+    cerr << "[LFI] Preloading " << preload << endl;
 
     newarg = (char**)malloc((argc+1)*sizeof(char*));
     for (i = 0; i < argc; ++i)
       newarg[i] = argv[i];
     newarg[argc] = NULL;
 
+    stacks = stacks_path();
     gettimeofday(&tvstart, NULL);
     if (0 == (monitor = fork()))
     {
-#ifdef __APPLE__
-      setenv(apple_env_flat, "", 1);
-      setenv(apple_no_dyldcache, "avoid", 1);
-#endif
-      setenv(preload, preload_path, 1);
-      execv(argv[0], newarg);
+      set_preload(preload);
+      if (wall_budget > 0 || cpu_budget > 0)
+        setenv(LFI_STACKS_ENV, stacks.c_str(), 1);
+      if (experiment_dir.empty() || 0 == chdir(experiment_dir.c_str()))
+        execv(argv[0], newarg);
       *runstatus = 1;
       shmdt(runstatus);
       _exit(0);
@@ -511,29 +1518,28 @@ int run_subject(int argc, char** argv, char* preload_library, char *envp[])
       }
       else
       {
-        waitpid(monitor, &status, 0);
+        hung = watch_subject(monitor, &status, &run.ru, stacks);
+        release_control(monitor);
         gettimeofday(&tvend, NULL);
+        return_value = CRASH_METRIC;
         if (0 != *runstatus)
         {
           return_value = -1;
         }
+        else if (hung)
+        {
+          cerr << "Process hung, killed after " << elapsed_since(&tvstart) << " s, stacks in "
+               << stacks << endl;
+          return_value = HANG_METRIC;
+        }
         else
         {
           if (WIFEXITED(status))
           {
             exit_status = WEXITSTATUS(status);
             cerr << "Process exited normally. Exit status: " << exit_status << endl;
-            if (exit_status)
-            {
-              return_value = exit_status;
-            }
-            else
-            {
-              /* leave the timing to the external sensor
-                 return_value = (tvend.tv_sec-tvstart.tv_sec)*100 + (tvend.tv_usec - tvstart.tv_usec)/10000;
-                 */
-              return_value = 0;
-            }
+            /* the timing goes to the usage record, not the score */
+            return_value = exit_metric(status);
 
           }
           else if (WIFSIGNALED(status))
@@ -541,16 +1547,23 @@ int run_subject(int argc, char** argv, char* preload_library, char *envp[])
             exit_signal = WTERMSIG(status);
             cerr << "Process terminated by signal " << exit_signal << endl;
 
-            fd = open(REPLAYFILE, O_WRONLY|O_APPEND);
-            write(fd, "</plan>\n", 8);
-            close(fd);
-
-            return_value = 128+WTERMSIG(status);
+            return_value = exit_metric(status);
           }
         }
+
+        if (-1 != return_value)
+        {
+          run.wall = seconds(tvend) - seconds(tvstart);
+          cerr << "[LFI] Usage: " << USAGE_COLUMNS << endl << "[LFI]        ";
+          print_usage(cerr, run);
+          cerr << endl;
+          write_usage(run);
+        }
       }
     }
   }
+  if (usage)
+    *usage = run;
   if (shmdt(runstatus) < 0)
   {
     perror("shmdt");
@@ -563,23 +1576,712 @@ int run_subject(int argc, char** argv, char* preload_library, char *envp[])
   return return_value;
 }
 
+/************************************************************************/
+/*  int prepare_experiment(char* config)                                */
+/*                                                                      */
+/*  Generates and compiles the stub library for config, or with -r      */
+/*  compiles the plan and points $LFI_PLAN at it, in experiment_dir     */
+/************************************************************************/
+static int prepare_experiment(char* config)
+{
+  char plan_path[PATH_MAX];
+  int status;
+
+  if (!prebuilt)
+    return generate_stub(config);
+
+  status = compile_plan(config, (char*)experiment_path(PLANFILE).c_str());
+  if (0 == status && !(realpath(experiment_path(PLANFILE).c_str(), plan_path) &&
+                       0 == setenv("LFI_PLAN", plan_path, 1)))
+    status = -1;
+  return status;
+}
+
+/************************************************************************/
+/*  campaigns (-j): every plan of a directory (*.xml) or of a list file */
+/*  (one path per line) is an experiment, run in its own directory      */
+/*  under $LFI_CAMPAIGN (default lfi-campaign). The stub library or     */
+/*  compiled plan, the target's inject.log, replay.bin and other files  */
+/*  and the output of libfi and of the target (libfi.log) stay there.   */
+/*  Each experiment is a child of libfi with its own run_subject, so    */
+/*  their status channels and control pages (/lfi-<pid>) are distinct   */
+/************************************************************************/
+#define CAMPAIGN_ENV      "LFI_CAMPAIGN"
+#define CAMPAIGN_DEFAULT  "lfi-campaign"
+/* no score yet: the plan didn't compile or the experiment died */
+#define NOT_RUN           INT_MIN
+
+/* the lines of path, without blank lines and # comments */
+static int read_list(const char* path, vector<string>& lines)
+{
+  string line;
+
+  ifstream in(path);
+  if (!in)
+  {
+    cerr << "Unable to open " << path << endl;
+    return -1;
+  }
+  while (getline(in, line))
+  {
+    line.erase(0, line.find_first_not_of(" \t\r"));
+    line.erase(line.find_last_not_of(" \t\r") + 1);
+    if (!line.empty() && line[0] != '#')
+      lines.push_back(line);
+  }
+  return 0;
+}
+
+static int campaign_plans(char* source, vector<string>& plans)
+{
+  struct stat st;
+  glob_t files;
+  size_t i;
+
+  if (0 == stat(source, &st) && S_ISDIR(st.st_mode))
+  {
+    if (0 == glob((string(source) + "/*.xml").c_str(), 0, NULL, &files))
+    {
+      for (i = 0; i < files.gl_pathc; ++i)
+        plans.push_back(files.gl_pathv[i]);
+      globfree(&files);
+    }
+    return 0;
+  }
+  return read_list(source, plans);
+}
+
+/* $LFI_CAMPAIGN, created if needed, NULL if it can't be */
+static const char* campaign_root(void)
+{
+  const char* root;
+
+  root = getenv(CAMPAIGN_ENV);
+  if (!root || !*root)
+    root = CAMPAIGN_DEFAULT;
+  if (mkdir(root, 0755) && EEXIST != errno)
+  {
+    cerr << "Unable to create " << root << endl;
+    return NULL;
+  }
+  return root;
+}
+
+/*
+   <root>/results, a header line ("# ...") then one line per experiment:
+   <label> <tab> <directory> <tab> <score>, "-" if it didn't run, and
+   its resource usage (USAGE_COLUMNS). Returns how many didn't run
+*/
+static int write_results(const char* root, const vector<string>& labels,
+                         const vector<string>& dirs, const vector<int>& scores,
+                         const vector<struct run_usage>& usages)
+{
+  int n, failed;
+
+  failed = 0;
+  ofstream results((string(root) + "/results").c_str());
+  results << "# label\tdirectory\tscore\t" << USAGE_COLUMNS << endl;
+  for (n = 0; n < (int)labels.size(); ++n)
+  {
+    results << labels[n] << "\t" << dirs[n] << "\t";
+    if (NOT_RUN == scores[n])
+    {
+      results << "-\t";
+      ++failed;
+    }
+    else
+      results << scores[n] << "\t";
+    print_usage(results, usages[n]);
+    results << endl;
+  }
+  cerr << "[LFI] Results in " << root << "/results" << endl;
+  return failed;
+}
+
+/* the directory of experiment n, named after its plan */
+static string campaign_dir(const char* root, int n, const string& plan)
+{
+  char prefix[16];
+  string name;
+  size_t slash, dot;
+
+  slash = plan.find_last_of('/');
+  name = plan.substr(slash == string::npos ? 0 : slash + 1);
+  dot = name.find_last_of('.');
+  if (dot != string::npos && dot > 0)
+    name.erase(dot);
+  sprintf(prefix, "%04d-", n);
+  return string(root) + "/" + prefix + name + "/";
+}
+
+/* in the child: runs experiment n, its score goes to scores[n] and its usage to usages[n] */
+static void run_experiment(int n, const string& plan, int run_argc, char** run_argv,
+                           char *envp[], volatile int* scores, struct run_usage* usages)
+{
+  int fd, status;
+
+  fd = open(experiment_path("libfi.log").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0)
+  {
+    dup2(fd, 1);
+    dup2(fd, 2);
+    close(fd);
+  }
+
+  status = prepare_experiment((char*)plan.c_str());
+  if (0 == status && run_argc && !generate_only)
+  {
+    if ((status = run_subject(run_argc, run_argv, prebuilt ? RUNTIMEEX : experiment_path(STUBEX).c_str(), envp,
+                              &usages[n])) < 0)
+      cerr << "A problem occurred starting the target" << endl;
+    else
+      scores[n] = status;
+  }
+  else if (0 == status)
+    scores[n] = 0;
+}
+
+/************************************************************************/
+/*  int run_campaign(char* source, int jobs, int run_argc,              */
+/*                   char** run_argv, char *envp[])                     */
+/*                                                                      */
+/*  Runs the experiments of source, at most jobs at a time (one per     */
+/*  core if jobs is 0), and writes the score run_subject returned for   */
+/*  each to the results file of the campaign directory, in plan order   */
+/*  (see write_results). Returns the number of experiments that didn't  */
+/*  run                                                                 */
+/************************************************************************/
+static int run_campaign(char* source, int jobs, int run_argc, char** run_argv, char *envp[])
+{
+  vector<string> plans, dirs;
+  map<pid_t, int> running;
+  volatile int* scores;
+  struct run_usage* usages;
+  const char* root;
+  char target[PATH_MAX];
+  int n, next, done, failed, status;
+  pid_t pid;
+
+  if (campaign_plans(source, plans))
+    return -1;
+  if (plans.empty())
+  {
+    cerr << "No plans in " << source << endl;
+    return -1;
+  }
+  if (jobs <= 0)
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (!(root = campaign_root()))
+    return -1;
+  for (n = 0; n < (int)plans.size(); ++n)
+  {
+    dirs.push_back(campaign_dir(root, n, plans[n]));
+    if (mkdir(dirs[n].c_str(), 0755) && EEXIST != errno)
+    {
+      cerr << "Unable to create " << dirs[n] << endl;
+      return -1;
+    }
+  }
+
+  /* the target runs in the experiment directory, a relative path to it wouldn't */
+  if (run_argc && strchr(run_argv[0], '/') && run_argv[0][0] != '/' && realpath(run_argv[0], target))
+    run_argv[0] = target;
+
+  scores = (volatile int*)mmap(NULL, plans.size() * sizeof(int), PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == scores)
+  {
+    perror("mmap");
+    return -1;
+  }
+  usages = (struct run_usage*)mmap(NULL, plans.size() * sizeof(struct run_usage),
+                                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == usages)
+  {
+    perror("mmap");
+    munmap((void*)scores, plans.size() * sizeof(int));
+    return -1;
+  }
+  for (n = 0; n < (int)plans.size(); ++n)
+  {
+    scores[n] = NOT_RUN;
+    usages[n] = no_usage;
+  }
+
+  cerr << "[LFI] Running " << plans.size() << " experiments in " << root
+       << ", " << jobs << " at a time" << endl;
+
+  next = done = 0;
+  while (done < (int)plans.size())
+  {
+    while (next < (int)plans.size() && (int)running.size() < jobs)
+    {
+      pid = fork();
+      if (0 == pid)
+      {
+        experiment_dir = dirs[next];
+        run_experiment(next, plans[next], run_argc, run_argv, envp, scores, usages);
+        _exit(0);
+      }
+      if (-1 == pid)
+      {
+        perror("fork");
+        if (running.empty())
+          return -1;
+        break;
+      }
+      running[pid] = next++;
+    }
+
+    pid = waitpid(-1, &status, 0);
+    if (-1 == pid)
+    {
+      if (EINTR == errno)
+        continue;
+      perror("waitpid");
+      break;
+    }
+    if (running.find(pid) == running.end())
+      continue;
+    n = running[pid];
+    running.erase(pid);
+    ++done;
+    if (NOT_RUN == scores[n])
+      cerr << "[LFI] " << done << "/" << plans.size() << " " << plans[n] << ": not run, see "
+           << dirs[n] << "libfi.log" << endl;
+    else
+      cerr << "[LFI] " << done << "/" << plans.size() << " " << plans[n] << ": " << scores[n] << endl;
+  }
+
+  failed = write_results(root, plans, dirs, vector<int>(scores, scores + plans.size()),
+                         vector<struct run_usage>(usages, usages + plans.size()));
+  munmap((void*)scores, plans.size() * sizeof(int));
+  munmap(usages, plans.size() * sizeof(struct run_usage));
+  return failed;
+}
+
+/************************************************************************/
+/*  fork server campaigns (-F, see forkserver.h): the plan is compiled  */
+/*  once, in the campaign directory, and each line of the experiment    */
+/*  list names the rows an experiment enables, as <function>[:<row>]    */
+/*  (all rows of the function without one) or "none". The experiments  */
+/*  run in the children of jobs targets started once, each in its own   */
+/*  directory, server-<n>. Each child moves to its experiment's         */
+/*  directory, <n>, numbered like the plans of a campaign               */
+/************************************************************************/
+struct forkserver
+{
+  pid_t pid;
+  int command;    /* libfi's ends of the pipes, -1 once it's gone */
+  int status;
+  int experiment; /* the one running, -1 if idle */
+  pid_t child;    /* the target running it, 0 until the server sent it */
+  struct timeval start;
+  int hung;
+  string dir;
+};
+
+/* the rows each experiment enables, by LFI_FN_<name> (see lfi_forkserver_run) */
+static int forkserver_experiments(plan_decl& plan, vector<string>& lines,
+                                  vector< vector<uint64_t> >& enabled)
+{
+  unordered_map<string, int>::iterator fn;
+  string item, name;
+  size_t colon;
+  int n, row;
+
+  for (n = 0; n < (int)lines.size(); ++n)
+  {
+    enabled.push_back(vector<uint64_t>(plan.functions.size(), 0));
+    istringstream items(lines[n]);
+    while (items >> item)
+    {
+      if (item == "none")
+        continue;
+      colon = item.find(':');
+      name = item.substr(0, colon);
+      fn = plan.functionIds.find(name);
+      if (fn == plan.functionIds.end())
+      {
+        cerr << "Experiment " << n + 1 << ": " << name << " is not in the plan" << endl;
+        return -1;
+      }
+      if (colon == string::npos)
+      {
+        enabled[n][fn->second] = ~0ULL;
+        continue;
+      }
+      row = atoi(item.c_str() + colon + 1);
+      if (row < 0 || row >= (int)plan.functions[fn->second].rows.size())
+      {
+        cerr << "Experiment " << n + 1 << ": " << name << " has no row " << row << endl;
+        return -1;
+      }
+      /* LFI_ROW_BIT (inter.h) */
+      enabled[n][fn->second] |= 1ULL << (row < 63 ? row : 63);
+    }
+  }
+  return 0;
+}
+
+static int read_all(int fd, void* buffer, size_t size)
+{
+  ssize_t n;
+
+  while (size)
+  {
+    n = read(fd, buffer, size);
+    if (n < 0 && EINTR == errno)
+      continue;
+    if (n <= 0)
+      return -1;
+    buffer = (char*)buffer + n;
+    size -= n;
+  }
+  return 0;
+}
+
+static void stop_forkserver(struct forkserver& server)
+{
+  int status;
+
+  if (server.command >= 0)
+  {
+    /* the server exits when the command pipe is closed */
+    close(server.command);
+    close(server.status);
+    server.command = server.status = -1;
+  }
+  if (server.pid > 0)
+  {
+    while (waitpid(server.pid, &status, 0) < 0 && EINTR == errno)
+      ;
+    release_control(server.pid);
+    server.pid = -1;
+  }
+}
+
+/* starts the target, returns once it reached point */
+static int start_forkserver(struct forkserver& server, int argc, char** argv,
+                            const char* preload_library, const char* point, int function_count)
+{
+  struct lfi_forkserver_hello hello;
+  char preload[1024];
+  char **newarg;
+  int command[2], status[2];
+  int fd, i;
+
+  server.pid = -1;
+  server.command = server.status = -1;
+  server.experiment = -1;
+  server.child = 0;
+  server.hung = 0;
+  if (mkdir(server.dir.c_str(), 0755) && EEXIST != errno)
+  {
+    cerr << "Unable to create " << server.dir << endl;
+    return -1;
+  }
+  if (preload_path(preload_library, preload, sizeof(preload)))
+    return -1;
+  if (pipe(command))
+    return -1;
+  if (pipe(status))
+  {
+    close(command[0]);
+    close(command[1]);
+    return -1;
+  }
+  /* the other servers must not keep these open */
+  for (i = 0; i < 2; ++i)
+  {
+    fcntl(command[i], F_SETFD, FD_CLOEXEC);
+    fcntl(status[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  server.pid = fork();
+  if (0 == server.pid)
+  {
+    dup2(command[0], LFI_FORKSERVER_COMMAND_FD);
+    dup2(status[1], LFI_FORKSERVER_STATUS_FD);
+    fd = open(experiment_path("libfi.log").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0)
+    {
+      dup2(fd, 1);
+      dup2(fd, 2);
+    }
+    newarg = (char**)malloc((argc+1)*sizeof(char*));
+    for (i = 0; i < argc; ++i)
+      newarg[i] = argv[i];
+    newarg[argc] = NULL;
+    set_preload(preload);
+    setenv(LFI_FORKSERVER_ENV, point, 1);
+    if (wall_budget > 0 || cpu_budget > 0)
+      setenv(LFI_STACKS_ENV, stacks_path().c_str(), 1);
+    if (0 == chdir(server.dir.c_str()))
+      execv(argv[0], newarg);
+    _exit(127);
+  }
+  close(command[0]);
+  close(status[1]);
+  server.command = command[1];
+  server.status = status[0];
+  if (server.pid < 0)
+  {
+    stop_forkserver(server);
+    return -1;
+  }
+
+  /* a target that hangs before the stop point is killed like in an experiment */
+  gettimeofday(&server.start, NULL);
+  while (wall_budget > 0 || cpu_budget > 0)
+  {
+    struct pollfd p = { server.status, POLLIN, 0 };
+    if (poll(&p, 1, 10) > 0)
+      break;
+    if (over_budget(server.pid, &server.start))
+    {
+      kill_hung(server.pid, stacks_path());
+      break;
+    }
+  }
+
+  if (read_all(server.status, &hello, sizeof(hello)) ||
+      hello.magic != LFI_FORKSERVER_MAGIC || (int)hello.function_count != function_count)
+  {
+    cerr << "The target didn't reach " << point << ", see " << server.dir << "libfi.log" << endl;
+    stop_forkserver(server);
+    return -1;
+  }
+  return 0;
+}
+
+/************************************************************************/
+/*  int run_forkservers(char* config, char* list, const char* point,    */
+/*                      int jobs, int run_argc, char** run_argv)        */
+/*                                                                      */
+/*  Runs the experiments of list with jobs fork servers (one per core   */
+/*  if jobs is 0) and writes their scores like run_campaign. Returns    */
+/*  the number of experiments that didn't run                           */
+/************************************************************************/
+static int run_forkservers(char* config, char* list, const char* point, int jobs,
+                           int run_argc, char** run_argv)
+{
+  vector<string> lines, dirs;
+  vector< vector<uint64_t> > enabled;
+  vector<int> scores;
+  vector<struct run_usage> usages;
+  vector<struct forkserver> servers;
+  vector<struct pollfd> polled;
+  struct lfi_forkserver_run run;
+  struct lfi_forkserver_status status;
+  plan_decl plan;
+  const char* root;
+  string path;
+  char target[PATH_MAX], cwd[PATH_MAX];
+  char name[32];
+  int32_t child;
+  int n, s, next, done, alive, timeout;
+
+  if (!run_argc)
+  {
+    cerr << "A fork server needs a target (-t)" << endl;
+    return -1;
+  }
+  if (read_list(list, lines) || read_plan(config, plan) ||
+      forkserver_experiments(plan, lines, enabled))
+    return -1;
+  if (jobs < 0)
+    jobs = 1;
+  else if (0 == jobs)
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if (jobs > (int)lines.size())
+    jobs = lines.size();
+
+  if (!(root = campaign_root()))
+    return -1;
+  for (n = 0; n < (int)lines.size(); ++n)
+  {
+    sprintf(name, "%04d/", n);
+    dirs.push_back(string(root) + "/" + name);
+    if (mkdir(dirs[n].c_str(), 0755) && EEXIST != errno)
+    {
+      cerr << "Unable to create " << dirs[n] << endl;
+      return -1;
+    }
+  }
+  experiment_dir = string(root) + "/";
+  if (prepare_experiment(config))
+    return -1;
+  if (strchr(run_argv[0], '/') && run_argv[0][0] != '/' && realpath(run_argv[0], target))
+    run_argv[0] = target;
+
+  servers.resize(jobs);
+  alive = 0;
+  for (s = 0; s < jobs; ++s)
+  {
+    sprintf(name, "server-%d/", s);
+    servers[s].dir = string(root) + "/" + name;
+    experiment_dir = servers[s].dir;
+    if (0 == start_forkserver(servers[s], run_argc, run_argv,
+                              prebuilt ? RUNTIMEEX : (string(root) + "/" + STUBEX).c_str(),
+                              point, plan.functions.size()))
+      ++alive;
+  }
+  experiment_dir = "";
+
+  cerr << "[LFI] Running " << lines.size() << " experiments in " << alive
+       << " fork servers, stopped in " << point << endl;
+
+  scores.assign(lines.size(), NOT_RUN);
+  usages.assign(lines.size(), no_usage);
+  run.magic = LFI_FORKSERVER_MAGIC;
+  run.function_count = plan.functions.size();
+  next = done = 0;
+  while (done < (int)lines.size() && alive)
+  {
+    /* idle servers get the next experiments */
+    for (s = 0; s < jobs && next < (int)lines.size(); ++s)
+    {
+      if (servers[s].command < 0 || servers[s].experiment >= 0)
+        continue;
+      /* the server runs in its own directory */
+      path = dirs[next];
+      if (path[0] != '/' && getcwd(cwd, sizeof(cwd)))
+        path = string(cwd) + "/" + path;
+      run.experiment = next;
+      run.dir_length = path.size();
+      if (write(servers[s].command, &run, sizeof(run)) != (ssize_t)sizeof(run) ||
+          (enabled[next].size() &&
+           write(servers[s].command, &enabled[next][0], enabled[next].size() * sizeof(uint64_t)) !=
+           (ssize_t)(enabled[next].size() * sizeof(uint64_t))) ||
+          write(servers[s].command, path.c_str(), run.dir_length) != (ssize_t)run.dir_length)
+      {
+        stop_forkserver(servers[s]);
+        --alive;
+        continue;
+      }
+      servers[s].experiment = next++;
+      servers[s].child = 0;
+      servers[s].hung = 0;
+      gettimeofday(&servers[s].start, NULL);
+    }
+
+    polled.clear();
+    for (s = 0; s < jobs; ++s)
+      if (servers[s].status >= 0 && servers[s].experiment >= 0)
+      {
+        struct pollfd p = { servers[s].status, POLLIN, 0 };
+        polled.push_back(p);
+      }
+    if (polled.empty())
+      break;
+    /* with a budget, the running targets are checked every 10 ms */
+    timeout = (wall_budget > 0 || cpu_budget > 0) ? 10 : -1;
+    if (poll(&polled[0], polled.size(), timeout) < 0)
+    {
+      if (EINTR == errno)
+        continue;
+      perror("poll");
+      break;
+    }
+
+    for (s = 0; s < jobs; ++s)
+    {
+      if (servers[s].status < 0 || servers[s].experiment < 0)
+        continue;
+      for (n = 0; n < (int)polled.size() && polled[n].fd != servers[s].status; ++n)
+        ;
+      if (!polled[n].revents)
+      {
+        /* the server sent the child's pid first (see forkserver.h) */
+        if (servers[s].child > 0 && !servers[s].hung &&
+            over_budget(servers[s].child, &servers[s].start))
+        {
+          experiment_dir = dirs[servers[s].experiment];
+          kill_hung(servers[s].child, stacks_path());
+          experiment_dir = "";
+          servers[s].hung = 1;
+        }
+        continue;
+      }
+
+      if (!servers[s].child)
+      {
+        if (0 == read_all(servers[s].status, &child, sizeof(child)))
+        {
+          servers[s].child = child;
+          continue;
+        }
+      }
+
+      n = servers[s].experiment;
+      servers[s].experiment = -1;
+      ++done;
+      if (read_all(servers[s].status, &status, sizeof(status)))
+      {
+        /* the server itself died, its experiment with it */
+        cerr << "[LFI] Fork server " << s << " is gone, see " << servers[s].dir << "libfi.log" << endl;
+        stop_forkserver(servers[s]);
+        --alive;
+      }
+      else if (status.pid > 0)
+      {
+        scores[n] = servers[s].hung ? HANG_METRIC : exit_metric(status.status);
+        usages[n].wall = elapsed_since(&servers[s].start);
+        usages[n].ru = status.usage;
+        experiment_dir = dirs[n];
+        write_usage(usages[n]);
+        experiment_dir = "";
+      }
+    }
+  }
+
+  for (s = 0; s < jobs; ++s)
+    stop_forkserver(servers[s]);
+  return write_results(root, lines, dirs, scores, usages);
+}
+
 int main(int argc, char* argv[], char* envp[])
 {
-  char *crash_create, *run_target, *token;
+  char *crash_create, *run_target, *token, *stop_point;
   char *run_argv[64];
-  int run_argc;
+  int run_argc, jobs;
   int status, crash_check, test_score;
 
   int c;
 
   crash_check = 0;
   run_target = NULL;
+  stop_point = NULL;
+  jobs = -1;
 
   opterr = 0;
-  while ((c = getopt (argc, argv, "t:f:")) != -1)
+  while ((c = getopt (argc, argv, "snrj:F:w:c:t:f:")) != -1)
   {
     switch (c)
     {
+    case 's':
+      specialized = 1;
+      break;
+    case 'r':
+      prebuilt = 1;
+      break;
+    case 'n':
+      generate_only = 1;
+      break;
+    case 'j':
+      jobs = atoi(optarg);
+      break;
+    case 'F':
+      stop_point = optarg;
+      break;
+    case 'w':
+      wall_budget = atof(optarg);
+      break;
+    case 'c':
+      cpu_budget = atof(optarg);
+      break;
     case 'f':
       crash_check = 1;
       crash_create = optarg;
@@ -588,8 +2290,9 @@ int main(int argc, char* argv[], char* envp[])
       run_target = optarg;
       break;
     case '?':
-      if (optopt == 'f')
-        fprintf (stderr, "Option -f requires an argument.\n");
+      if (optopt == 'f' || optopt == 'j' || optopt == 'F' ||
+          optopt == 'w' || optopt == 'c' || optopt == 't')
+        fprintf (stderr, "Option -%c requires an argument.\n", optopt);
       else if (isprint (optopt))
         fprintf (stderr, "Unknown option `-%c'.\n", optopt);
       else
@@ -599,7 +2302,7 @@ int main(int argc, char* argv[], char* envp[])
       abort ();
     }
   }
-  if (optind >= argc)
+  if (optind >= argc || (stop_point && optind + 1 >= argc))
   {
     usage(argv[0]);
     return -1;
@@ -607,7 +2310,7 @@ int main(int argc, char* argv[], char* envp[])
 
   //++optind
   run_argc = 0;
-  token = strtok(run_target, "\t ");
+  token = run_target ? strtok(run_target, "\t ") : NULL;
   while (token)
   {
     run_argv[run_argc++] = token;
@@ -615,12 +2318,24 @@ int main(int argc, char* argv[], char* envp[])
   }
 
   LIBXML_TEST_VERSION
-    status = generate_stub(argv[optind]);
+  if (stop_point)
+  {
+    status = run_forkservers(argv[optind], argv[optind + 1], stop_point, jobs, run_argc, run_argv);
+    xmlCleanupParser();
+    return status ? 1 : 0;
+  }
+  if (jobs >= 0)
+  {
+    status = run_campaign(argv[optind], jobs, run_argc, run_argv, envp);
+    xmlCleanupParser();
+    return status ? 1 : 0;
+  }
+  status = prepare_experiment(argv[optind]);
   xmlCleanupParser();
   test_score = 0;
-  if (run_target) {
+  if (run_target && !generate_only) {
     if (0 == status) {
-      if ((test_score = run_subject(run_argc, run_argv, STUBEX, envp)) < 0)
+      if ((test_score = run_subject(run_argc, run_argv, prebuilt ? RUNTIMEEX : experiment_path(STUBEX).c_str(), envp, NULL)) < 0)
         cerr << "A problem occurred starting the target" << endl;
     }
   }
@@ -0,0 +1,608 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#ifndef __APPLE__
+#include <elf.h>
+#include <link.h>
+#endif
+
+#include "linetable.h"
+
+using namespace std;
+
+#ifndef __APPLE__
+
+/* DWARF constants (see the DWARF 5 standard, 6.2 and 7.5.5) */
+#define DW_LNS_copy               1
+#define DW_LNS_advance_pc         2
+#define DW_LNS_advance_line       3
+#define DW_LNS_set_file           4
+#define DW_LNS_const_add_pc       8
+#define DW_LNS_fixed_advance_pc   9
+#define DW_LNE_end_sequence       1
+#define DW_LNE_set_address        2
+#define DW_LNE_define_file        3
+#define DW_LNCT_path              1
+#define DW_LNCT_directory_index   2
+#define DW_FORM_block2            0x03
+#define DW_FORM_block4            0x04
+#define DW_FORM_data2             0x05
+#define DW_FORM_data4             0x06
+#define DW_FORM_data8             0x07
+#define DW_FORM_string            0x08
+#define DW_FORM_block             0x09
+#define DW_FORM_block1            0x0a
+#define DW_FORM_data1             0x0b
+#define DW_FORM_sdata             0x0d
+#define DW_FORM_strp              0x0e
+#define DW_FORM_udata             0x0f
+#define DW_FORM_data16            0x1e
+#define DW_FORM_line_strp         0x1f
+
+/* a cursor over a section, reads nothing past end */
+struct reader
+{
+  const unsigned char* p;
+  const unsigned char* end;
+  bool offset64;
+
+  bool ok() const { return p <= end; }
+
+  uint64_t fixed(int size)
+  {
+    uint64_t value = 0;
+    int i;
+
+    if (end - p < size)
+    {
+      p = end + 1;
+      return 0;
+    }
+    /* little-endian targets only, like the rest of LFI */
+    for (i = size - 1; i >= 0; --i)
+      value = (value << 8) | p[i];
+    p += size;
+    return value;
+  }
+
+  uint64_t uleb()
+  {
+    uint64_t value = 0;
+    int shift = 0;
+
+    while (p < end)
+    {
+      value |= (uint64_t)(*p & 0x7f) << (shift < 63 ? shift : 63);
+      shift += 7;
+      if (!(*p++ & 0x80))
+        return value;
+    }
+    p = end + 1;
+    return value;
+  }
+
+  int64_t sleb()
+  {
+    int64_t value = 0;
+    int shift = 0;
+    unsigned char byte = 0;
+
+    while (p < end)
+    {
+      byte = *p++;
+      value |= (int64_t)(byte & 0x7f) << (shift < 63 ? shift : 63);
+      shift += 7;
+      if (!(byte & 0x80))
+      {
+        if (shift < 64 && (byte & 0x40))
+          value |= -((int64_t)1 << shift);
+        return value;
+      }
+    }
+    p = end + 1;
+    return value;
+  }
+
+  const char* cstring()
+  {
+    const unsigned char* s = p;
+
+    while (p < end && *p)
+      ++p;
+    if (p >= end)
+    {
+      p = end + 1;
+      return "";
+    }
+    ++p;
+    return (const char*)s;
+  }
+
+  uint64_t offset() { return fixed(offset64 ? 8 : 4); }
+};
+
+/* a string of .debug_line_str or .debug_str */
+static const char* section_string(const unsigned char* section, size_t size, uint64_t offset)
+{
+  if (!section || offset >= size || !memchr(section + offset, 0, size - offset))
+    return "";
+  return (const char*)section + offset;
+}
+
+/* the string in an attribute of form, NULL for other values (skipped) */
+static const char* read_form(reader& r, uint64_t form,
+                             const unsigned char* lineStr, size_t lineStrSize,
+                             const unsigned char* str, size_t strSize, uint64_t* value)
+{
+  *value = 0;
+  switch (form)
+  {
+  case DW_FORM_string:    return r.cstring();
+  case DW_FORM_line_strp: return section_string(lineStr, lineStrSize, r.offset());
+  case DW_FORM_strp:      return section_string(str, strSize, r.offset());
+  case DW_FORM_data1:     *value = r.fixed(1); break;
+  case DW_FORM_data2:     *value = r.fixed(2); break;
+  case DW_FORM_data4:     *value = r.fixed(4); break;
+  case DW_FORM_data8:     *value = r.fixed(8); break;
+  case DW_FORM_data16:    r.fixed(8); r.fixed(8); break;
+  case DW_FORM_udata:     *value = r.uleb(); break;
+  case DW_FORM_sdata:     *value = r.sleb(); break;
+  case DW_FORM_block1:    r.p += r.fixed(1); break;
+  case DW_FORM_block2:    r.p += r.fixed(2); break;
+  case DW_FORM_block4:    r.p += r.fixed(4); break;
+  case DW_FORM_block:     r.p += r.uleb(); break;
+  default:
+    /* can't be skipped, the rest of the header is lost */
+    r.p = r.end + 1;
+  }
+  return NULL;
+}
+
+static string join_path(const string& dir, const char* name)
+{
+  if (name[0] == '/' || dir.empty())
+    return name;
+  return dir + "/" + name;
+}
+
+int LineTable::AddFile(const string& path)
+{
+  map<string, int>::iterator it = fileIds.find(path);
+
+  if (it != fileIds.end())
+    return it->second;
+  files.push_back(path);
+  return fileIds[path] = files.size() - 1;
+}
+
+/* one unit of .debug_line: the header, then the line program */
+bool LineTable::ReadUnit(const unsigned char* unit, const unsigned char* end,
+                         const unsigned char* lineStr, size_t lineStrSize,
+                         const unsigned char* str, size_t strSize)
+{
+  vector<string> dirs;
+  vector<int> unitFiles; /* by the unit's file number */
+  vector<uint64_t> formats;
+  vector<unsigned char> opcodeLengths;
+  reader r, program;
+  uint64_t headerLength, count, i, j, value, dir, length;
+  unsigned minLength, lineRange, opcodeBase, opcode, adjusted, version, addressSize;
+  int lineBase, fileBase;
+  const char *name, *s;
+  LineRow row;
+  uintptr_t address;
+  int64_t line;
+  int64_t file;
+
+  r.p = unit;
+  r.end = end;
+  r.offset64 = false;
+  version = r.fixed(2);
+  if (version < 2 || version > 5)
+    return false;
+  addressSize = sizeof(void*);
+  if (version >= 5)
+  {
+    addressSize = r.fixed(1);
+    r.fixed(1); /* segment selector size */
+  }
+  headerLength = r.offset();
+  if (!r.ok() || headerLength > (uint64_t)(end - r.p))
+    return false;
+  program.p = r.p + headerLength;
+  program.end = end;
+  program.offset64 = r.offset64;
+
+  minLength = r.fixed(1);
+  if (version >= 4)
+    r.fixed(1); /* maximum operations per instruction, for VLIW */
+  r.fixed(1); /* default is_stmt */
+  lineBase = (signed char)r.fixed(1);
+  lineRange = r.fixed(1);
+  opcodeBase = r.fixed(1);
+  if (!r.ok() || !lineRange || !opcodeBase)
+    return false;
+  for (i = 1; i < opcodeBase; ++i)
+    opcodeLengths.push_back(r.fixed(1));
+
+  if (version < 5)
+  {
+    /* the unit's own directory is implied, files count from 1 */
+    dirs.push_back("");
+    while (r.ok() && *(s = r.cstring()))
+      dirs.push_back(s);
+    unitFiles.push_back(-1);
+    while (r.ok() && *(name = r.cstring()))
+    {
+      dir = r.uleb();
+      r.uleb(); /* modification time */
+      r.uleb(); /* length */
+      unitFiles.push_back(AddFile(join_path(dir < dirs.size() ? dirs[dir] : "", name)));
+    }
+    fileBase = 1;
+  }
+  else
+  {
+    /* entries described by (content type, form) pairs, counted from 0 */
+    count = r.fixed(1);
+    for (i = 0; i < count * 2 && r.ok(); ++i)
+      formats.push_back(r.uleb());
+    count = r.uleb();
+    for (i = 0; i < count && r.ok(); ++i)
+    {
+      name = "";
+      for (j = 0; j + 1 < formats.size(); j += 2)
+        if ((s = read_form(r, formats[j + 1], lineStr, lineStrSize, str, strSize, &value)) &&
+            DW_LNCT_path == formats[j])
+          name = s;
+      dirs.push_back(name);
+    }
+
+    formats.clear();
+    count = r.fixed(1);
+    for (i = 0; i < count * 2 && r.ok(); ++i)
+      formats.push_back(r.uleb());
+    count = r.uleb();
+    for (i = 0; i < count && r.ok(); ++i)
+    {
+      name = "";
+      dir = 0;
+      for (j = 0; j + 1 < formats.size(); j += 2)
+      {
+        s = read_form(r, formats[j + 1], lineStr, lineStrSize, str, strSize, &value);
+        if (DW_LNCT_path == formats[j] && s)
+          name = s;
+        else if (DW_LNCT_directory_index == formats[j])
+          dir = value;
+      }
+      unitFiles.push_back(AddFile(join_path(dir < dirs.size() ? dirs[dir] : "", name)));
+    }
+    fileBase = 0;
+  }
+  if (!r.ok())
+    return false;
+
+  /* the line program (DWARF 5, 6.2.5) */
+  address = 0;
+  file = fileBase;
+  line = 1;
+  while (program.p < program.end)
+  {
+    opcode = program.fixed(1);
+    if (opcode >= opcodeBase)
+    {
+      /* special opcode: advance both, then add a row */
+      adjusted = opcode - opcodeBase;
+      address += (adjusted / lineRange) * minLength;
+      line += lineBase + (int)(adjusted % lineRange);
+    }
+    else if (0 == opcode)
+    {
+      length = program.uleb();
+      if (!program.ok() || length > (uint64_t)(program.end - program.p) || !length)
+        break;
+      r.p = program.p + 1;
+      r.end = program.p + length;
+      opcode = *program.p;
+      program.p += length;
+      if (DW_LNE_end_sequence == opcode)
+      {
+        row.address = address;
+        row.file = -1;
+        row.line = 0;
+        rows.push_back(row);
+        address = 0;
+        file = fileBase;
+        line = 1;
+      }
+      else if (DW_LNE_set_address == opcode)
+        address = r.fixed(length - 1 < addressSize ? length - 1 : addressSize);
+      else if (DW_LNE_define_file == opcode)
+        unitFiles.push_back(AddFile(join_path(dirs.empty() ? "" : dirs[0], r.cstring())));
+      continue;
+    }
+    else if (DW_LNS_copy != opcode)
+    {
+      switch (opcode)
+      {
+      case DW_LNS_advance_pc:       address += program.uleb() * minLength; break;
+      case DW_LNS_advance_line:     line += program.sleb(); break;
+      case DW_LNS_set_file:         file = program.uleb(); break;
+      case DW_LNS_const_add_pc:     address += ((255 - opcodeBase) / lineRange) * minLength; break;
+      case DW_LNS_fixed_advance_pc: address += program.fixed(2); break;
+      default:
+        /* column, is_stmt, basic block...: only their operands matter */
+        for (i = 0; i < opcodeLengths[opcode - 1]; ++i)
+          program.uleb();
+      }
+      continue;
+    }
+
+    row.address = address;
+    row.file = (file >= 0 && file < (int64_t)unitFiles.size()) ? unitFiles[file] : -1;
+    row.line = line;
+    if (row.file >= 0)
+      rows.push_back(row);
+  }
+  return true;
+}
+
+/* the end of a sequence sorts before a row at the same address */
+static bool row_before(const LineRow& a, const LineRow& b)
+{
+  if (a.address != b.address)
+    return a.address < b.address;
+  return (a.file >= 0) < (b.file >= 0);
+}
+
+bool LineTable::Load(const char* path)
+{
+  const ElfW(Ehdr)* ehdr;
+  const ElfW(Shdr) *shdr, *section;
+  const unsigned char *image, *line, *lineStr, *str, *unit, *end;
+  size_t lineSize, lineStrSize, strSize;
+  const char* names;
+  struct stat st;
+  uint64_t length;
+  reader r;
+  int fd, i;
+
+  rows.clear();
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return false;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(ElfW(Ehdr)) ||
+      MAP_FAILED == (image = (const unsigned char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)))
+  {
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+  ehdr = (const ElfW(Ehdr)*)image;
+  line = lineStr = str = NULL;
+  lineSize = lineStrSize = strSize = 0;
+  if (0 == memcmp(ehdr->e_ident, ELFMAG, SELFMAG) &&
+      ehdr->e_ident[EI_CLASS] == (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32) &&
+      ehdr->e_shoff && ehdr->e_shstrndx < ehdr->e_shnum &&
+      ehdr->e_shoff + ehdr->e_shnum * sizeof(ElfW(Shdr)) <= (uint64_t)st.st_size)
+  {
+    shdr = (const ElfW(Shdr)*)(image + ehdr->e_shoff);
+    names = (const char*)image + shdr[ehdr->e_shstrndx].sh_offset;
+    for (i = 0; i < ehdr->e_shnum; ++i)
+    {
+      section = &shdr[i];
+      if (SHT_NOBITS == section->sh_type || (section->sh_flags & SHF_COMPRESSED) ||
+          section->sh_offset + section->sh_size > (uint64_t)st.st_size)
+        continue;
+      if (!strcmp(names + section->sh_name, ".debug_line"))
+      {
+        line = image + section->sh_offset;
+        lineSize = section->sh_size;
+      }
+      else if (!strcmp(names + section->sh_name, ".debug_line_str"))
+      {
+        lineStr = image + section->sh_offset;
+        lineStrSize = section->sh_size;
+      }
+      else if (!strcmp(names + section->sh_name, ".debug_str"))
+      {
+        str = image + section->sh_offset;
+        strSize = section->sh_size;
+      }
+    }
+  }
+
+  for (unit = line; unit && unit < line + lineSize; unit = end)
+  {
+    r.p = unit;
+    r.end = line + lineSize;
+    r.offset64 = false;
+    length = r.fixed(4);
+    if (0xffffffff == length)
+    {
+      r.offset64 = true;
+      length = r.fixed(8);
+    }
+    if (!r.ok() || length > (uint64_t)(r.end - r.p))
+      break;
+    end = r.p + length;
+    ReadUnit(r.p, end, lineStr, lineStrSize, str, strSize);
+  }
+  munmap((void*)image, st.st_size);
+
+  stable_sort(rows.begin(), rows.end(), row_before);
+  return !rows.empty();
+}
+
+/* the last few addresses looked up by this thread (a direct-mapped cache) */
+#define RECENT_LINES  16
+
+struct recent_line
+{
+  const LineTable* table;
+  uintptr_t address;
+  const char* file;
+  int line;
+};
+
+static __thread struct recent_line recent[RECENT_LINES];
+
+bool LineTable::Lookup(uintptr_t address, const char** file, int* line) const
+{
+  struct recent_line* cached;
+  vector<LineRow>::const_iterator it;
+  LineRow key;
+
+  cached = &recent[(address >> 2) % RECENT_LINES];
+  if (cached->table == this && cached->address == address)
+  {
+    *file = cached->file;
+    *line = cached->line;
+    return NULL != *file;
+  }
+
+  /* the last row at or before address */
+  key.address = address;
+  key.file = 0;
+  it = upper_bound(rows.begin(), rows.end(), key, row_before);
+  if (it == rows.begin() || (--it)->file < 0)
+  {
+    *file = NULL;
+    *line = 0;
+  }
+  else
+  {
+    *file = files[it->file].c_str();
+    *line = it->line;
+  }
+
+  cached->table = this;
+  cached->address = address;
+  cached->file = *file;
+  cached->line = *line;
+  return NULL != *file;
+}
+
+/* path is file, or ends with "/" + file */
+static bool same_file(const string& path, const char* file)
+{
+  size_t length = strlen(file);
+
+  if (path.size() < length || path.compare(path.size() - length, length, file))
+    return false;
+  return path.size() == length || '/' == file[0] || '/' == path[path.size() - length - 1];
+}
+
+void LineTable::Ranges(const char* file, int line, vector< pair<uintptr_t, uintptr_t> >& ranges) const
+{
+  vector<bool> wanted(files.size());
+  size_t f, r, first;
+
+  for (f = 0; f < files.size(); ++f)
+    wanted[f] = same_file(files[f], file);
+
+  first = ranges.size();
+  for (r = 0; r + 1 < rows.size(); ++r)
+  {
+    /* of the rows at one address, the last one holds (as in Lookup) */
+    if (rows[r].file < 0 || rows[r].line != line || !wanted[rows[r].file] ||
+        rows[r + 1].address == rows[r].address)
+      continue;
+    /* the row's code ends where the next address starts */
+    if (ranges.size() > first && ranges.back().second == rows[r].address)
+      ranges.back().second = rows[r + 1].address;
+    else
+      ranges.push_back(make_pair(rows[r].address, rows[r + 1].address));
+  }
+}
+
+struct base_search
+{
+  const char* path;
+  char real[PATH_MAX];
+  uintptr_t base;
+  bool found;
+};
+
+static int find_base(struct dl_phdr_info* info, size_t, void* data)
+{
+  struct base_search* search = (struct base_search*)data;
+  char real[PATH_MAX];
+  const char* name;
+
+  /* the main program has no name */
+  name = (info->dlpi_name && info->dlpi_name[0]) ? info->dlpi_name : "/proc/self/exe";
+  if (strcmp(name, search->path) && (!realpath(name, real) || strcmp(real, search->real)))
+    return 0;
+  search->base = info->dlpi_addr;
+  search->found = true;
+  return 1;
+}
+
+bool lfi_object_base(const char* path, uintptr_t* base)
+{
+  struct base_search search;
+
+  search.path = path;
+  if (!realpath(path, search.real))
+    strcpy(search.real, "");
+  search.found = false;
+  dl_iterate_phdr(find_base, &search);
+  if (search.found)
+    *base = search.base;
+  return search.found;
+}
+
+#else
+
+bool LineTable::Load(const char*)
+{
+  return false;
+}
+
+bool LineTable::Lookup(uintptr_t, const char**, int*) const
+{
+  return false;
+}
+
+void LineTable::Ranges(const char*, int, vector< pair<uintptr_t, uintptr_t> >&) const
+{
+}
+
+bool lfi_object_base(const char*, uintptr_t*)
+{
+  return false;
+}
+
+#endif
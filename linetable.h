@@ -0,0 +1,81 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+   source lines of the code of an ELF object, from its .debug_line (DWARF
+   2 to 5), for the triggers that look at call sites by file and line.
+   The line programs are run once, by Load, into a sorted array of rows:
+   looking an address up is a binary search, without symbolizing anything
+   or starting addr2line. Addresses are the object's link addresses, the
+   running code's minus the load address (see lfi_object_base).
+   Compressed sections and separate debug files are not supported
+*/
+
+struct LineRow
+{
+  uintptr_t address;
+  int file; /* -1: the end of a sequence, no code from here */
+  int line;
+};
+
+class LineTable
+{
+public:
+  /* reads the line tables of the object at path, false if it has none */
+  bool Load(const char* path);
+  bool Empty() const { return rows.empty(); }
+
+  /*
+     the file and line of the instruction at address. file stays valid as
+     long as the table, and is the same pointer for the same file
+  */
+  bool Lookup(uintptr_t address, const char** file, int* line) const;
+
+  /*
+     appends the address ranges [first, second) of the code of line in
+     file, a path or the end of one ("ls.c" is "src/ls.c" as well)
+  */
+  void Ranges(const char* file, int line,
+              std::vector< std::pair<uintptr_t, uintptr_t> >& ranges) const;
+
+private:
+  bool ReadUnit(const unsigned char* unit, const unsigned char* end,
+                const unsigned char* lineStr, size_t lineStrSize,
+                const unsigned char* str, size_t strSize);
+  int AddFile(const std::string& path);
+
+  std::vector<std::string> files;
+  std::map<std::string, int> fileIds;
+  std::vector<LineRow> rows;
+};
+
+/* the load address of the object at path, false if it isn't loaded */
+bool lfi_object_base(const char* path, uintptr_t* base);
@@ -0,0 +1,278 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "Trigger.h"
+#include "inter.h"
+#include "logring.h"
+
+#ifdef WITH_LOGS
+
+extern int log_fd;
+uint64_t tsc();
+
+/*
+   single producer (the owning thread), single consumer (whoever holds
+   drain_lock). A ring whose thread exited is reused by a new thread
+*/
+struct log_ring
+{
+  volatile unsigned long head; /* next record to write */
+  volatile unsigned long tail; /* next record to flush */
+  volatile int in_use;
+  struct log_ring *next;
+  struct log_record records[LOG_RING_SIZE];
+};
+
+static struct log_ring *volatile rings;
+/* the calling thread's ring is lfi_thread.log_ring (see inter.h) */
+static pthread_key_t ring_key;
+
+static volatile int drain_lock;
+static volatile int flusher_running;
+static volatile int flusher_stop;
+static pthread_t flusher;
+static long flush_interval_ms = 50;
+static long sync_interval_ms = 0;
+
+static void release_ring(void *ring)
+{
+  __atomic_store_n(&((struct log_ring*)ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static struct log_ring* get_ring(void)
+{
+  struct log_ring *ring;
+
+  if (lfi_thread.log_ring)
+    return (struct log_ring*)lfi_thread.log_ring;
+
+  /* a ring left by a thread that exited? */
+  for (ring = rings; ring; ring = ring->next)
+    if (!ring->in_use && __sync_bool_compare_and_swap(&ring->in_use, 0, 1))
+      break;
+
+  if (!ring)
+  {
+    ring = (struct log_ring*)calloc(1, sizeof(struct log_ring));
+    if (!ring)
+      return NULL;
+    ring->in_use = 1;
+    do {
+      ring->next = rings;
+    } while (!__sync_bool_compare_and_swap(&rings, ring->next, ring));
+  }
+
+  pthread_setspecific(ring_key, ring);
+  lfi_thread.log_ring = ring;
+  return ring;
+}
+
+static void write_all(int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0 && (n = write(fd, buf, len)) > 0)
+  {
+    buf += n;
+    len -= n;
+  }
+}
+
+/* writes everything buffered in the rings, the caller holds drain_lock */
+static void drain_locked(void)
+{
+  char logbuf[16384];
+  size_t loglen;
+  struct log_ring *ring;
+  struct log_record *r;
+  unsigned long head, tail;
+
+  loglen = 0;
+  for (ring = rings; ring; ring = ring->next)
+  {
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (tail = ring->tail; tail != head; ++tail)
+    {
+      if (loglen > sizeof(logbuf) - 512)
+      {
+        write_all(log_fd, logbuf, loglen);
+        loglen = 0;
+      }
+
+      r = &ring->records[tail & (LOG_RING_SIZE - 1)];
+      loglen += snprintf(logbuf + loglen, sizeof(logbuf) - loglen,
+                         "[ %s, %llu %ld %ld] Returning code %d; setting errno to %d\n",
+                         lfi_function_names[r->function_id], (unsigned long long)r->tsc,
+                         r->cpu_sec, r->cpu_nsec, r->return_code, r->return_errno);
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  }
+  write_all(log_fd, logbuf, loglen);
+}
+
+static void drain(void)
+{
+  while (__sync_lock_test_and_set(&drain_lock, 1))
+    sched_yield();
+  drain_locked();
+  __sync_lock_release(&drain_lock);
+}
+
+static void* flush_thread(void *)
+{
+  struct timespec interval, now, last_sync;
+
+  /* this thread belongs to LFI, never inject in its calls */
+  set_no_intercept(1);
+
+  interval.tv_sec = flush_interval_ms / 1000;
+  interval.tv_nsec = (flush_interval_ms % 1000) * 1000000;
+  clock_gettime(CLOCK_MONOTONIC, &last_sync);
+
+  while (!flusher_stop)
+  {
+    nanosleep(&interval, NULL);
+    drain();
+
+    if (sync_interval_ms > 0)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if ((now.tv_sec - last_sync.tv_sec) * 1000 +
+          (now.tv_nsec - last_sync.tv_nsec) / 1000000 >= sync_interval_ms)
+      {
+        fdatasync(log_fd);
+        last_sync = now;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* the child only gets the forking thread: the parent flushes what is buffered */
+static void atfork_child(void)
+{
+  struct log_ring *ring;
+
+  flusher_running = 0;
+  drain_lock = 0;
+  for (ring = rings; ring; ring = ring->next)
+  {
+    ring->tail = ring->head;
+    if (ring != lfi_thread.log_ring)
+      ring->in_use = 0;
+  }
+}
+
+void lfi_log_init(void)
+{
+  const char *env;
+
+  if ((env = getenv("LFI_LOG_FLUSH_MS")) && atol(env) > 0)
+    flush_interval_ms = atol(env);
+  if ((env = getenv("LFI_LOG_SYNC_MS")))
+    sync_interval_ms = atol(env);
+
+  pthread_key_create(&ring_key, release_ring);
+  pthread_atfork(NULL, NULL, atfork_child);
+
+  lfi_log_restart();
+}
+
+void lfi_log_restart(void)
+{
+  flusher_stop = 0;
+  if (!flusher_running && 0 == pthread_create(&flusher, NULL, flush_thread, NULL))
+    flusher_running = 1;
+}
+
+void lfi_log_fini(void)
+{
+  if (flusher_running)
+  {
+    flusher_stop = 1;
+    pthread_join(flusher, NULL);
+    flusher_running = 0;
+  }
+  drain();
+  if (sync_interval_ms > 0)
+    fdatasync(log_fd);
+}
+
+void lfi_log_flush(void)
+{
+  int spins;
+
+  /* don't deadlock if the crash happened while draining */
+  for (spins = 0; spins < 1000000 && __sync_lock_test_and_set(&drain_lock, 1); ++spins)
+    ;
+  drain_locked();
+  fdatasync(log_fd);
+}
+
+void lfi_log_injection(int function_id, int return_code, int return_errno)
+{
+  struct log_ring *ring;
+  struct log_record *r;
+  struct timespec t = {0, 0};
+  unsigned long head;
+
+  if (!(ring = get_ring()))
+    return;
+
+  head = ring->head;
+  while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE)
+  {
+    /* full: help the flusher (or replace it, after a fork) */
+    if (!__sync_lock_test_and_set(&drain_lock, 1))
+    {
+      drain_locked();
+      __sync_lock_release(&drain_lock);
+    }
+    else
+      sched_yield();
+  }
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+
+  r = &ring->records[head & (LOG_RING_SIZE - 1)];
+  r->function_id = function_id;
+  r->return_code = return_code;
+  r->return_errno = return_errno;
+  r->tsc = tsc();
+  r->cpu_sec = (long)t.tv_sec;
+  r->cpu_nsec = t.tv_nsec;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
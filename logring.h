@@ -0,0 +1,59 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   injection log, built with WITH_LOGS
+
+   determine_action appends a record for every injected fault to a lock-free
+   ring owned by the calling thread. A flusher thread drains all the rings
+   in batches to LOGFILE; the rings are also drained when the stub library
+   is unloaded and from the SIGSEGV handler. Nothing is synced to disk
+   unless requested:
+
+     LFI_LOG_FLUSH_MS  interval between two flushes (default 50)
+     LFI_LOG_SYNC_MS   fdatasync the logs at most this often (default 0, never)
+*/
+
+/* records per thread, must be a power of 2 */
+#define LOG_RING_SIZE  1024
+
+struct log_record
+{
+  int function_id;
+  int return_code;
+  int return_errno;
+  uint64_t tsc;
+  long cpu_sec;
+  long cpu_nsec;
+};
+
+void lfi_log_init(void);
+/* starts the flusher again in a child of the fork server, which only has the forking thread */
+void lfi_log_restart(void);
+void lfi_log_fini(void);
+void lfi_log_injection(int function_id, int return_code, int return_errno);
+/* flushes whatever is buffered, called on the crash path */
+void lfi_log_flush(void);
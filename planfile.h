@@ -0,0 +1,98 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+#include <stdint.h>
+
+/*
+   compiled plan (PLANFILE), written by libfi -r and mapped read-only by
+   the prebuilt runtime (see runtime.h), which needs no XML parser
+
+   The file starts with a plan_header, followed by the tables it points
+   to: the functions (in LFI_FN_<name> order), their rows (the rows of a
+   function are consecutive), the trigger references of the rows, the
+   triggers in use (the order of lfi_triggers), the decoded trigger
+   arguments (see TriggerArg.h) and the strings. Everything is decoded:
+   return values and errno are numbers, arguments are linked by index
+   (-1 for none) and strings are offsets in the string table
+*/
+
+#define PLAN_MAGIC    "LFIPLAN1"
+#define PLAN_VERSION  1
+
+struct plan_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t size;
+  uint32_t function_count;
+  uint32_t row_count;
+  uint32_t ref_count;
+  uint32_t trigger_count;
+  uint32_t arg_count;
+  uint32_t strings_size;
+  /* file offsets of the tables */
+  uint32_t functions;
+  uint32_t rows;
+  uint32_t refs;      /* uint32_t indexes of triggers */
+  uint32_t triggers;
+  uint32_t args;
+  uint32_t strings;
+};
+
+struct plan_function
+{
+  uint32_t name;
+  uint32_t symbol;
+  uint32_t first_row;
+  uint32_t row_count;
+};
+
+struct plan_row
+{
+  int32_t return_value;
+  int32_t errno_value;
+  int32_t call_original;
+  int32_t argc;
+  uint32_t first_ref;
+  uint32_t ref_count;
+};
+
+struct plan_trigger
+{
+  uint32_t id;
+  uint32_t tclass;
+  int32_t args;      /* the <args> node */
+  uint32_t reserved;
+};
+
+struct plan_arg
+{
+  uint32_t name;
+  uint32_t text;
+  int64_t value;
+  int32_t children;
+  int32_t next;
+};
@@ -0,0 +1,167 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   replay2xml - decodes a binary replay log (replay.bin, see replaylog.h)
+
+   prints the injections as a plan of <function ... inject="N" /> elements,
+   or, with -t, as one line of text per injection. -n <index> only decodes
+   the record at that position in the log
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "replaylog.h"
+
+using namespace std;
+
+static void
+usage(char* me)
+{
+  cout << "Usage: ";
+  cout << me << " [-t] [-n <record index>] <replay file>" << endl;
+}
+
+static void
+print_record(const struct replay_record* r, const vector<string>& names, int text)
+{
+  const char* name;
+
+  name = r->function_id < names.size() ? names[r->function_id].c_str() : "?";
+  if (text)
+    printf("[ %s, %llu] thread %u, call %llu: returning code %d; setting errno to %d\n",
+           name, (unsigned long long)r->tsc, r->thread_index,
+           (unsigned long long)r->call_index, r->return_code, r->return_errno);
+  else
+    printf("<function name=\"%s\" inject=\"%llu\" retval=\"%d\" errno=\"%d\" calloriginal=\"0\" />\n",
+           name, (unsigned long long)r->call_index, r->return_code, r->return_errno);
+}
+
+int main(int argc, char* argv[])
+{
+  const struct replay_header* header;
+  const struct replay_record* records;
+  vector<string> names;
+  const char* name;
+  struct stat st;
+  uint64_t count, i, index;
+  int c, fd, text, single;
+  void* p;
+
+  text = single = 0;
+  index = 0;
+  while ((c = getopt(argc, argv, "tn:")) != -1)
+  {
+    switch (c)
+    {
+    case 't':
+      text = 1;
+      break;
+    case 'n':
+      single = 1;
+      index = strtoull(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+  if ((size_t)st.st_size < sizeof(struct replay_header) ||
+      MAP_FAILED == (p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)))
+  {
+    cerr << argv[optind] << ": not a replay log" << endl;
+    return 1;
+  }
+
+  header = (const struct replay_header*)p;
+  if (memcmp(header->magic, REPLAY_MAGIC, sizeof(header->magic)) ||
+      header->version != REPLAY_VERSION ||
+      header->record_size != sizeof(struct replay_record) ||
+      header->records_offset > (uint64_t)st.st_size)
+  {
+    cerr << argv[optind] << ": not a replay log or unsupported version" << endl;
+    return 1;
+  }
+
+  name = (const char*)(header + 1);
+  for (i = 0; i < header->function_count; ++i)
+  {
+    names.push_back(name);
+    name += strlen(name) + 1;
+  }
+
+  /* the last chunk may be only partially used (or the writer crashed) */
+  records = (const struct replay_record*)((const char*)p + header->records_offset);
+  count = header->record_count;
+  if (count > (st.st_size - header->records_offset) / sizeof(struct replay_record))
+    count = (st.st_size - header->records_offset) / sizeof(struct replay_record);
+
+  if (single)
+  {
+    if (index >= count || !records[index].tsc)
+    {
+      cerr << "No record " << index << " (" << count << " records)" << endl;
+      return 1;
+    }
+    print_record(&records[index], names, text);
+    return 0;
+  }
+
+  if (!text)
+    printf("<plan>\n");
+  for (i = 0; i < count; ++i)
+    if (records[i].tsc)
+      print_record(&records[i], names, text);
+  if (!text)
+    printf("</plan>\n");
+
+  munmap(p, st.st_size);
+  close(fd);
+  return 0;
+}
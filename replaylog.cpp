@@ -0,0 +1,186 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "Trigger.h"
+#include "inter.h"
+#include "replaylog.h"
+
+#ifdef WITH_LOGS
+
+extern int replay_fd;
+uint64_t tsc();
+
+/* address space reserved for the records, mapped one chunk at a time */
+#ifdef __LP64__
+#define REPLAY_MAX_SIZE  (64UL << 30)
+#else
+#define REPLAY_MAX_SIZE  (256UL << 20)
+#endif
+
+#define RECORDS_PER_CHUNK  (REPLAY_CHUNK_SIZE / sizeof(struct replay_record))
+
+static struct replay_header *header;
+static struct replay_record *records;
+/* records mapped in this process */
+static volatile uint64_t mapped;
+static volatile int map_lock;
+static int atfork_registered;
+
+/* maps file chunks until the record at index is backed by the file */
+static int map_records(uint64_t index)
+{
+  off_t offset;
+  void *chunk;
+  int ret = 0;
+
+  while (__sync_lock_test_and_set(&map_lock, 1))
+    ;
+  while (index >= mapped)
+  {
+    if ((mapped + RECORDS_PER_CHUNK) * sizeof(struct replay_record) > REPLAY_MAX_SIZE)
+    {
+      ret = -1;
+      break;
+    }
+
+    /* never shrinks the file, other processes may be appending too (fork) */
+    offset = header->records_offset + mapped * sizeof(struct replay_record);
+    if (posix_fallocate(replay_fd, offset, REPLAY_CHUNK_SIZE))
+    {
+      ret = -1;
+      break;
+    }
+    chunk = mmap(records + mapped, REPLAY_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, replay_fd, offset);
+    if (MAP_FAILED == chunk)
+    {
+      ret = -1;
+      break;
+    }
+    __atomic_store_n(&mapped, mapped + RECORDS_PER_CHUNK, __ATOMIC_RELEASE);
+  }
+  __sync_lock_release(&map_lock);
+  return ret;
+}
+
+static void atfork_child(void)
+{
+  map_lock = 0;
+}
+
+void lfi_replay_init(void)
+{
+  uint32_t names_size;
+  uint64_t records_offset;
+  long page;
+  char *names;
+  void *p;
+  int i;
+
+  /* a child of the fork server starts its own log */
+  if (header)
+  {
+    munmap(records, REPLAY_MAX_SIZE);
+    munmap(header, header->records_offset);
+    header = NULL;
+    mapped = 0;
+  }
+
+  names_size = 0;
+  for (i = 0; i < lfi_function_count; ++i)
+    names_size += strlen(lfi_function_names[i]) + 1;
+
+  page = sysconf(_SC_PAGESIZE);
+  records_offset = (sizeof(struct replay_header) + names_size + page - 1) / page * page;
+
+  if (posix_fallocate(replay_fd, 0, records_offset))
+    return;
+  p = mmap(NULL, records_offset, PROT_READ | PROT_WRITE, MAP_SHARED, replay_fd, 0);
+  if (MAP_FAILED == p)
+    return;
+
+  header = (struct replay_header*)p;
+  memcpy(header->magic, REPLAY_MAGIC, sizeof(header->magic));
+  header->version = REPLAY_VERSION;
+  header->record_size = sizeof(struct replay_record);
+  header->function_count = lfi_function_count;
+  header->names_size = names_size;
+  header->records_offset = records_offset;
+  header->record_count = 0;
+
+  names = (char*)(header + 1);
+  for (i = 0; i < lfi_function_count; ++i)
+  {
+    strcpy(names, lfi_function_names[i]);
+    names += strlen(lfi_function_names[i]) + 1;
+  }
+
+  p = mmap(NULL, REPLAY_MAX_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (MAP_FAILED == p)
+  {
+    header = NULL;
+    return;
+  }
+  records = (struct replay_record*)p;
+  if (!atfork_registered)
+  {
+    pthread_atfork(NULL, NULL, atfork_child);
+    atfork_registered = 1;
+  }
+  map_records(0);
+}
+
+void lfi_replay_record(int function_id, unsigned long call_index,
+                       int return_code, int return_errno)
+{
+  struct replay_record *r;
+  uint64_t index, t;
+
+  if (!header)
+    return;
+
+  index = __sync_fetch_and_add(&header->record_count, 1);
+  if (index >= __atomic_load_n(&mapped, __ATOMIC_ACQUIRE) && map_records(index))
+    return;
+
+  r = &records[index];
+  r->function_id = function_id;
+  r->thread_index = lfi_thread_index();
+  r->call_index = call_index;
+  r->return_code = return_code;
+  r->return_errno = return_errno;
+  t = tsc();
+  __atomic_store_n(&r->tsc, t ? t : 1, __ATOMIC_RELEASE);
+}
+
+#endif
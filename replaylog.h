@@ -0,0 +1,72 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+#include <stdint.h>
+
+/*
+   binary replay log (REPLAYFILE), written by stub libraries built WITH_LOGS
+   and decoded offline by replay2xml
+
+   The file starts with a replay_header, followed by the names of the
+   intercepted functions (NUL terminated, in LFI_FN_<name> order). Records
+   start at records_offset and have a fixed size, so the Nth injection is
+   at records_offset + N * sizeof(struct replay_record). The file is
+   extended in REPLAY_CHUNK_SIZE steps: only the first record_count records
+   are meaningful, and a record with a 0 tsc was never completed
+*/
+
+#define REPLAY_MAGIC       "LFIRPLY1"
+#define REPLAY_VERSION     1
+#define REPLAY_CHUNK_SIZE  (1 << 20)
+
+struct replay_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t function_count;
+  uint32_t names_size;
+  uint64_t records_offset;
+  /* updated atomically by the writers, through the shared mapping */
+  volatile uint64_t record_count;
+};
+
+struct replay_record
+{
+  uint32_t function_id;
+  uint32_t thread_index;
+  /* 1 for the first call made to the function */
+  uint64_t call_index;
+  int32_t return_code;
+  int32_t return_errno;
+  /* stored last, 0 if the process died while writing the record */
+  uint64_t tsc;
+};
+
+/* (re)starts the log in replay_fd, the previous one is left as it is */
+void lfi_replay_init(void);
+void lfi_replay_record(int function_id, unsigned long call_index,
+                       int return_code, int return_errno);
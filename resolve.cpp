@@ -0,0 +1,302 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   resolves the original (next) definition of every intercepted function
+   in one pass, when the stub library is loaded: the dynamic symbol table
+   of each object loaded after the stub library is walked once and every
+   symbol is looked up in a hash table of the intercepted names. This
+   replaces one dlsym(RTLD_NEXT) per function, made by each stub on its
+   first call (taking the loader lock, racing with the other threads)
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "Trigger.h"
+#include "inter.h"
+#ifdef LFI_RUNTIME
+#include "runtime.h"
+#endif
+
+/* set once lfi_original is read-only */
+static volatile int sealed;
+
+#ifndef __APPLE__
+#include <link.h>
+#include <elf.h>
+
+#ifndef STT_GNU_IFUNC
+#define STT_GNU_IFUNC  10
+#endif
+
+/* open addressing, indexes of lfi_symbol_names (-1 is empty) */
+static int *name_table;
+static unsigned int name_mask;
+
+static uint32_t name_hash(const char *s)
+{
+  uint32_t h = 2166136261u;
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+static int build_name_table(void)
+{
+  unsigned int size, h;
+  int f;
+
+  for (size = 16; size < 2 * (unsigned)lfi_function_count; size <<= 1)
+    ;
+  name_table = (int*)malloc(size * sizeof(int));
+  if (!name_table)
+    return -1;
+  memset(name_table, 0xff, size * sizeof(int));
+  name_mask = size - 1;
+
+  for (f = 0; f < lfi_function_count; ++f)
+  {
+    for (h = name_hash(lfi_symbol_names[f]) & name_mask; name_table[h] >= 0; h = (h + 1) & name_mask)
+      ;
+    name_table[h] = f;
+  }
+  return 0;
+}
+
+static int lookup_name(const char *name)
+{
+  unsigned int h;
+
+  if (!name_table)
+    return -1;
+  for (h = name_hash(name) & name_mask; name_table[h] >= 0; h = (h + 1) & name_mask)
+    if (0 == strcmp(lfi_symbol_names[name_table[h]], name))
+      return name_table[h];
+  return -1;
+}
+
+/* number of symbols in a DT_GNU_HASH table (the highest symbol index + 1) */
+static uint32_t gnu_hash_symbol_count(const uint32_t *gnu_hash)
+{
+  uint32_t nbuckets, symoffset, bloom_size, i, last;
+  const uint32_t *buckets, *chain;
+
+  nbuckets = gnu_hash[0];
+  symoffset = gnu_hash[1];
+  bloom_size = gnu_hash[2];
+  buckets = gnu_hash + 4 + bloom_size * (sizeof(ElfW(Addr)) / 4);
+  chain = buckets + nbuckets;
+
+  last = 0;
+  for (i = 0; i < nbuckets; ++i)
+    if (buckets[i] > last)
+      last = buckets[i];
+  if (last < symoffset)
+    return symoffset;
+  while (!(chain[last - symoffset] & 1))
+    ++last;
+  return last + 1;
+}
+
+int lfi_object_contains(struct dl_phdr_info *info, const void *addr)
+{
+  ElfW(Addr) a = (ElfW(Addr))addr;
+  int i;
+
+  for (i = 0; i < info->dlpi_phnum; ++i)
+    if (PT_LOAD == info->dlpi_phdr[i].p_type &&
+        a >= info->dlpi_addr + info->dlpi_phdr[i].p_vaddr &&
+        a < info->dlpi_addr + info->dlpi_phdr[i].p_vaddr + info->dlpi_phdr[i].p_memsz)
+      return 1;
+  return 0;
+}
+
+struct walk_state
+{
+  const void *after;   /* only objects loaded after the one containing it */
+  int found_self;
+  int unresolved;
+};
+
+static int resolve_object(struct dl_phdr_info *info, size_t, void *data)
+{
+  struct walk_state *state = (struct walk_state*)data;
+  const ElfW(Dyn) *dyn = NULL;
+  const ElfW(Sym) *symtab = NULL;
+  const char *strtab = NULL;
+  const ElfW(Half) *versym = NULL;
+  const uint32_t *hash = NULL, *gnu_hash = NULL;
+  uint32_t nsyms, i;
+  unsigned char type;
+  void *addr;
+  int f;
+
+  if (!state->found_self)
+  {
+    if (lfi_object_contains(info, state->after))
+      state->found_self = 1;
+    return 0;
+  }
+  /* the vdso exports some libc names (e.g. clock_gettime) but isn't what dlsym returns */
+  if (info->dlpi_name && 0 == strncmp(info->dlpi_name, "linux-", 6))
+    return 0;
+
+  for (i = 0; i < info->dlpi_phnum; ++i)
+    if (PT_DYNAMIC == info->dlpi_phdr[i].p_type)
+      dyn = (const ElfW(Dyn)*)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+  if (!dyn)
+    return 0;
+
+  /* the loader has already relocated these entries */
+  for (; DT_NULL != dyn->d_tag; ++dyn)
+  {
+    switch (dyn->d_tag)
+    {
+    case DT_SYMTAB:   symtab = (const ElfW(Sym)*)dyn->d_un.d_ptr; break;
+    case DT_STRTAB:   strtab = (const char*)dyn->d_un.d_ptr; break;
+    case DT_VERSYM:   versym = (const ElfW(Half)*)dyn->d_un.d_ptr; break;
+    case DT_HASH:     hash = (const uint32_t*)dyn->d_un.d_ptr; break;
+    case DT_GNU_HASH: gnu_hash = (const uint32_t*)dyn->d_un.d_ptr; break;
+    }
+  }
+  if (!symtab || !strtab || (!hash && !gnu_hash))
+    return 0;
+
+  nsyms = hash ? hash[1] : gnu_hash_symbol_count(gnu_hash);
+  for (i = 1; i < nsyms; ++i)
+  {
+    type = ELF64_ST_TYPE(symtab[i].st_info);
+    if (SHN_UNDEF == symtab[i].st_shndx || 0 == symtab[i].st_value ||
+        (STT_FUNC != type && STT_GNU_IFUNC != type && STT_NOTYPE != type) ||
+        STB_LOCAL == ELF64_ST_BIND(symtab[i].st_info))
+      continue;
+    /* like dlsym: only the default version of a versioned symbol */
+    if (versym && ((versym[i] & 0x8000) || 0 == versym[i]))
+      continue;
+    if ((f = lookup_name(strtab + symtab[i].st_name)) < 0 || lfi_original[f])
+      continue;
+
+    addr = (void*)(info->dlpi_addr + symtab[i].st_value);
+    if (STT_GNU_IFUNC == type)
+      addr = ((void* (*)(void))addr)();
+    lfi_original[f] = addr;
+    if (0 == --state->unresolved)
+      return 1;
+  }
+  return 0;
+}
+#endif
+
+/************************************************************************/
+/* fills lfi_original (once, from the constructor) and makes it         */
+/* read-only. Functions that can't be found by walking the symbol       */
+/* tables are looked up with dlsym                                      */
+/************************************************************************/
+void lfi_resolve_all(void)
+{
+  int f;
+
+#ifndef __APPLE__
+  struct walk_state state;
+
+  state.after = (const void*)lfi_resolve_all;
+  state.found_self = 0;
+  state.unresolved = 0;
+  for (f = 0; f < lfi_function_count; ++f)
+    if (!lfi_original[f])
+      ++state.unresolved;
+
+  /* kept for lfi_symbol_id */
+  if (0 == build_name_table() && state.unresolved)
+    dl_iterate_phdr(resolve_object, &state);
+#endif
+
+  for (f = 0; f < lfi_function_count; ++f)
+  {
+    if (!lfi_original[f])
+      lfi_original[f] = dlsym(RTLD_NEXT, lfi_symbol_names[f]);
+    if (!lfi_original[f])
+      printf("Unable to get address for function %s\n", lfi_symbol_names[f]);
+#ifdef LFI_RUNTIME
+    else if (0 == strcmp(lfi_symbol_names[f], "dlopen"))
+      lfi_original[f] = (void*)lfi_runtime_dlopen;
+#endif
+  }
+
+  sealed = 1;
+  mprotect((void*)lfi_original, LFI_ORIGINAL_TABLE_SIZE(lfi_function_count), PROT_READ);
+}
+
+#ifndef __APPLE__
+/* the LFI_FN_<name> looked up by symbol, -1 if it isn't intercepted */
+int lfi_symbol_id(const char* symbol)
+{
+  return lookup_name(symbol);
+}
+#endif
+
+#ifndef __APPLE__
+static int count_objects(struct dl_phdr_info *info, size_t size, void *data)
+{
+  /* glibc keeps these in every entry, the first one is enough */
+  if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+    *(unsigned long*)data = info->dlpi_adds + info->dlpi_subs;
+  return 1;
+}
+#endif
+
+/*
+   the loader counts the objects it loads and unloads: reading that count
+   doesn't interpose dlopen, which would make the stub library its caller
+   (for $ORIGIN, RUNPATH and the namespace of the loaded object)
+*/
+unsigned long lfi_objects_generation()
+{
+  unsigned long generation = 0;
+
+#ifndef __APPLE__
+  dl_iterate_phdr(count_objects, &generation);
+#endif
+  return generation;
+}
+
+/* calls made before the constructor (e.g. by other libraries' constructors) */
+void* lfi_resolve(int function_id)
+{
+  void* addr;
+
+  addr = dlsym(RTLD_NEXT, lfi_symbol_names[function_id]);
+  if (!addr)
+    printf("Unable to get address for function %s\n", lfi_symbol_names[function_id]);
+  else if (!sealed)
+    lfi_original[function_id] = addr;
+  return addr;
+}
@@ -0,0 +1,430 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   prebuilt runtime: maps the compiled plan at startup and intercepts by
+   patching the GOT of the loaded objects (see runtime.h)
+*/
+
+#if !defined(__x86_64__) || defined(__APPLE__)
+#error "the prebuilt runtime is only available on Linux x86_64"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <link.h>
+#include <elf.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Trigger.h"
+#include "inter.h"
+#include "planfile.h"
+#include "runtime.h"
+
+/* what the generated stub file defines (see libfi.cpp) */
+int log_fd, replay_fd;
+int init_done;
+
+const char* lfi_function_names[LFI_RUNTIME_MAX_FUNCTIONS + 1];
+const char* lfi_symbol_names[LFI_RUNTIME_MAX_FUNCTIONS + 1];
+int lfi_function_count;
+void* lfi_original[LFI_ORIGINAL_TABLE_LENGTH(LFI_RUNTIME_MAX_FUNCTIONS)] __attribute__ ((aligned (LFI_PAGE_SIZE)));
+volatile unsigned long lfi_armed[LFI_RUNTIME_MAX_FUNCTIONS];
+unsigned long lfi_rows_armed[LFI_RUNTIME_MAX_FUNCTIONS];
+volatile unsigned long lfi_call_counts[LFI_RUNTIME_MAX_FUNCTIONS];
+struct fninfov2* lfi_function_info[LFI_RUNTIME_MAX_FUNCTIONS + 1];
+TriggerDesc* lfi_triggers[LFI_RUNTIME_MAX_TRIGGERS + 1];
+const lfi_decide_fn lfi_specialized[LFI_RUNTIME_MAX_FUNCTIONS + 1] = { NULL };
+
+extern "C" void lfi_trampoline_x64(void) LFI_HIDDEN;
+
+/************************************************************************/
+/* plan loading: the compiled plan is mapped read-only and the tables   */
+/* point into it, only the rows, the trigger descriptors and the links  */
+/* between the trigger arguments are allocated                          */
+/************************************************************************/
+static const char* plan;
+static size_t plan_size;
+
+/* a table of count elements of type T at offset, inside the file */
+template <class T>
+static const T* plan_table(uint32_t offset, uint32_t count)
+{
+  if (offset % 4 || offset > plan_size || count > (plan_size - offset) / sizeof(T))
+    return NULL;
+  return (const T*)(plan + offset);
+}
+
+static const char* plan_string(const struct plan_header* header, uint32_t offset)
+{
+  return offset < header->strings_size ? plan + header->strings + offset : NULL;
+}
+
+static int load_plan(const struct plan_header* header)
+{
+  const struct plan_function* functions;
+  const struct plan_row* rows;
+  const uint32_t* refs;
+  const struct plan_trigger* triggers;
+  const struct plan_arg* args;
+  TriggerArg* nodes;
+  TriggerDesc* desc;
+  uint32_t f, r, i;
+
+  if (memcmp(header->magic, PLAN_MAGIC, sizeof(header->magic)) || PLAN_VERSION != header->version ||
+      header->size != plan_size)
+    return -1;
+  functions = plan_table<struct plan_function>(header->functions, header->function_count);
+  rows = plan_table<struct plan_row>(header->rows, header->row_count);
+  refs = plan_table<uint32_t>(header->refs, header->ref_count);
+  triggers = plan_table<struct plan_trigger>(header->triggers, header->trigger_count);
+  args = plan_table<struct plan_arg>(header->args, header->arg_count);
+  /* every string ends within the table */
+  if (!functions || !rows || !refs || !triggers || !args ||
+      !plan_table<char>(header->strings, header->strings_size) ||
+      (header->strings_size && plan[header->strings + header->strings_size - 1]))
+    return -1;
+  if (header->function_count > LFI_RUNTIME_MAX_FUNCTIONS || header->trigger_count > LFI_RUNTIME_MAX_TRIGGERS)
+  {
+    printf("LFI: the plan has more than %d functions or %d triggers\n",
+           LFI_RUNTIME_MAX_FUNCTIONS, LFI_RUNTIME_MAX_TRIGGERS);
+    return -1;
+  }
+
+  nodes = (TriggerArg*)calloc(header->arg_count + 1, sizeof(TriggerArg));
+  if (!nodes)
+    return -1;
+  for (i = 0; i < header->arg_count; ++i)
+  {
+    nodes[i].name = plan_string(header, args[i].name);
+    nodes[i].text = plan_string(header, args[i].text);
+    nodes[i].value = args[i].value;
+    if (!nodes[i].name || !nodes[i].text ||
+        args[i].children >= (int32_t)header->arg_count || args[i].next >= (int32_t)header->arg_count)
+      return -1;
+    nodes[i].children = args[i].children < 0 ? NULL : &nodes[args[i].children];
+    nodes[i].next = args[i].next < 0 ? NULL : &nodes[args[i].next];
+  }
+
+  for (i = 0; i < header->trigger_count; ++i)
+  {
+    desc = (TriggerDesc*)calloc(1, sizeof(TriggerDesc));
+    if (!desc || !plan_string(header, triggers[i].id) || !plan_string(header, triggers[i].tclass) ||
+        triggers[i].args >= (int32_t)header->arg_count)
+      return -1;
+    strncpy(desc->id, plan_string(header, triggers[i].id), sizeof(desc->id) - 1);
+    strncpy(desc->tclass, plan_string(header, triggers[i].tclass), sizeof(desc->tclass) - 1);
+    desc->args = triggers[i].args < 0 ? NULL : &nodes[triggers[i].args];
+    lfi_triggers[i] = desc;
+  }
+
+  for (f = 0; f < header->function_count; ++f)
+  {
+    lfi_function_names[f] = plan_string(header, functions[f].name);
+    lfi_symbol_names[f] = plan_string(header, functions[f].symbol);
+    if (!lfi_function_names[f] || !lfi_symbol_names[f] ||
+        functions[f].first_row > header->row_count ||
+        functions[f].row_count > header->row_count - functions[f].first_row)
+      return -1;
+
+    lfi_function_info[f] = (struct fninfov2*)calloc(functions[f].row_count + 1, sizeof(struct fninfov2));
+    if (!lfi_function_info[f])
+      return -1;
+    for (r = 0; r < functions[f].row_count; ++r)
+    {
+      const struct plan_row* row = &rows[functions[f].first_row + r];
+      struct fninfov2* info = &lfi_function_info[f][r];
+
+      if (row->first_ref > header->ref_count || row->ref_count > header->ref_count - row->first_ref)
+        return -1;
+      info->function_id = f;
+      info->return_value = row->return_value;
+      info->errno_value = row->errno_value;
+      info->call_original = row->call_original;
+      info->argc = row->argc;
+      info->triggers = (TriggerDesc**)calloc(row->ref_count + 1, sizeof(TriggerDesc*));
+      if (!info->triggers)
+        return -1;
+      for (i = 0; i < row->ref_count; ++i)
+      {
+        if (refs[row->first_ref + i] >= header->trigger_count)
+          return -1;
+        info->triggers[i] = lfi_triggers[refs[row->first_ref + i]];
+      }
+    }
+    lfi_function_info[f][functions[f].row_count].function_id = LFI_FN_NONE;
+  }
+  lfi_function_count = header->function_count;
+  return 0;
+}
+
+int lfi_runtime_load(void)
+{
+  const char* path;
+  struct stat st;
+  void* map;
+  int fd;
+
+  path = getenv(LFI_PLAN_ENV);
+  if (!path)
+  {
+    printf("LFI: $%s is not set, nothing is intercepted\n", LFI_PLAN_ENV);
+    return -1;
+  }
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat(fd, &st) || st.st_size < (off_t)sizeof(struct plan_header))
+  {
+    printf("LFI: unable to open %s\n", path);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == map)
+    return -1;
+  plan = (const char*)map;
+  plan_size = st.st_size;
+
+  if (load_plan((const struct plan_header*)plan))
+  {
+    /* nothing was patched yet, the target runs without the plan */
+    printf("LFI: %s is not a plan compiled by libfi -r, nothing is intercepted\n", path);
+    lfi_function_count = 0;
+    lfi_triggers[0] = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/************************************************************************/
+/* trampolines: the machine code of GENERATE_TRAMPOLINE_x64 (inter.h),  */
+/* with absolute addresses instead of %rip-relative ones. r10 and r11   */
+/* are scratch registers that don't carry arguments in the SysV ABI     */
+/************************************************************************/
+#define LFI_TRAMPOLINE_SIZE  64
+
+static unsigned char* trampolines;
+
+static unsigned char* emit(unsigned char* p, const char* code, size_t size)
+{
+  memcpy(p, code, size);
+  return p + size;
+}
+
+static unsigned char* emit_address(unsigned char* p, const volatile void* address)
+{
+  uint64_t value = (uint64_t)(uintptr_t)address;
+
+  memcpy(p, &value, sizeof(value));
+  return p + sizeof(value);
+}
+
+static void write_trampoline(unsigned char* p, int function_id)
+{
+  uint32_t id = function_id;
+
+#ifndef WITH_LOGS
+  p = emit(p, "\x49\xbb", 2);             /* movabs $&lfi_original[id], %r11 */
+  p = emit_address(p, &lfi_original[function_id]);
+  p = emit(p, "\x4d\x8b\x1b", 3);         /* movq (%r11), %r11 */
+  p = emit(p, "\x4d\x85\xdb", 3);         /* testq %r11, %r11 */
+  p = emit(p, "\x74\x13", 2);             /* jz 1f */
+  p = emit(p, "\x49\xba", 2);             /* movabs $&lfi_armed[id], %r10 */
+  p = emit_address(p, &lfi_armed[function_id]);
+  p = emit(p, "\x49\x83\x3a\x00", 4);     /* cmpq $0, (%r10) */
+  p = emit(p, "\x75\x03", 2);             /* jne 1f */
+  p = emit(p, "\x41\xff\xe3", 3);         /* jmp *%r11 */
+#endif
+  /* 1: */
+  p = emit(p, "\x41\xbb", 2);             /* movl $id, %r11d */
+  memcpy(p, &id, sizeof(id));
+  p += sizeof(id);
+  p = emit(p, "\x49\xba", 2);             /* movabs $lfi_trampoline_x64, %r10 */
+  p = emit_address(p, (void*)lfi_trampoline_x64);
+  p = emit(p, "\x41\xff\xe2", 3);         /* jmp *%r10 */
+}
+
+static int write_trampolines(void)
+{
+  size_t size;
+  void* page;
+  int f;
+
+  size = (lfi_function_count * LFI_TRAMPOLINE_SIZE + LFI_PAGE_SIZE - 1) / LFI_PAGE_SIZE * LFI_PAGE_SIZE;
+  page = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == page)
+    return -1;
+  for (f = 0; f < lfi_function_count; ++f)
+    write_trampoline((unsigned char*)page + f * LFI_TRAMPOLINE_SIZE, f);
+  if (mprotect(page, size, PROT_READ | PROT_EXEC))
+  {
+    munmap(page, size);
+    return -1;
+  }
+  trampolines = (unsigned char*)page;
+  return 0;
+}
+
+/************************************************************************/
+/* GOT patching: every JUMP_SLOT (PLT call) and GLOB_DAT (address       */
+/* taken, -fno-plt call) relocation of an intercepted symbol is pointed */
+/* at its trampoline. The loader is done with these entries, those in   */
+/* the RELRO segment are made writable for the time of the patch        */
+/************************************************************************/
+static pthread_mutex_t patch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct relro
+{
+  uintptr_t start, end;
+  int writable;
+};
+
+static void patch_relocations(struct dl_phdr_info* info, const ElfW(Rela)* rela, size_t size,
+                              const ElfW(Sym)* symtab, const char* strtab, struct relro* relro)
+{
+  const ElfW(Rela)* end;
+  void** slot;
+  void* trampoline;
+  unsigned long type;
+  int f;
+
+  if (!rela)
+    return;
+  for (end = (const ElfW(Rela)*)((const char*)rela + size); rela < end; ++rela)
+  {
+    type = ELF64_R_TYPE(rela->r_info);
+    if (R_X86_64_JUMP_SLOT != type && R_X86_64_GLOB_DAT != type)
+      continue;
+    if ((f = lfi_symbol_id(strtab + symtab[ELF64_R_SYM(rela->r_info)].st_name)) < 0)
+      continue;
+
+    slot = (void**)(info->dlpi_addr + rela->r_offset);
+    trampoline = trampolines + f * LFI_TRAMPOLINE_SIZE;
+    if (*slot == trampoline)
+      continue;
+    if (!relro->writable && (uintptr_t)slot >= relro->start && (uintptr_t)slot < relro->end)
+    {
+      if (mprotect((void*)relro->start, relro->end - relro->start, PROT_READ | PROT_WRITE))
+        continue;
+      relro->writable = 1;
+    }
+    *slot = trampoline;
+  }
+}
+
+static int patch_object(struct dl_phdr_info* info, size_t, void*)
+{
+  const ElfW(Dyn)* dyn = NULL;
+  const ElfW(Sym)* symtab = NULL;
+  const char* strtab = NULL;
+  const ElfW(Rela) *jmprel = NULL, *rela = NULL;
+  size_t jmprel_size = 0, rela_size = 0;
+  struct relro relro = { 0, 0, 0 };
+  int i;
+
+  /* not the runtime itself, the vdso or the dynamic loader */
+  if (lfi_object_contains(info, (const void*)lfi_runtime_patch))
+    return 0;
+  if (info->dlpi_name && 0 == strncmp(info->dlpi_name, "linux-", 6))
+    return 0;
+  if (info->dlpi_addr == getauxval(AT_BASE))
+    return 0;
+
+  for (i = 0; i < info->dlpi_phnum; ++i)
+  {
+    if (PT_DYNAMIC == info->dlpi_phdr[i].p_type)
+      dyn = (const ElfW(Dyn)*)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+    else if (PT_GNU_RELRO == info->dlpi_phdr[i].p_type)
+    {
+      relro.start = (info->dlpi_addr + info->dlpi_phdr[i].p_vaddr) & ~(uintptr_t)(LFI_PAGE_SIZE - 1);
+      relro.end = (info->dlpi_addr + info->dlpi_phdr[i].p_vaddr + info->dlpi_phdr[i].p_memsz
+                   + LFI_PAGE_SIZE - 1) & ~(uintptr_t)(LFI_PAGE_SIZE - 1);
+    }
+  }
+  if (!dyn)
+    return 0;
+
+  /* the loader has already relocated these entries (see resolve.cpp) */
+  for (; DT_NULL != dyn->d_tag; ++dyn)
+  {
+    switch (dyn->d_tag)
+    {
+    case DT_SYMTAB:   symtab = (const ElfW(Sym)*)dyn->d_un.d_ptr; break;
+    case DT_STRTAB:   strtab = (const char*)dyn->d_un.d_ptr; break;
+    case DT_JMPREL:   jmprel = (const ElfW(Rela)*)dyn->d_un.d_ptr; break;
+    case DT_PLTRELSZ: jmprel_size = dyn->d_un.d_val; break;
+    case DT_RELA:     rela = (const ElfW(Rela)*)dyn->d_un.d_ptr; break;
+    case DT_RELASZ:   rela_size = dyn->d_un.d_val; break;
+    }
+  }
+  if (!symtab || !strtab)
+    return 0;
+
+  patch_relocations(info, jmprel, jmprel_size, symtab, strtab, &relro);
+  patch_relocations(info, rela, rela_size, symtab, strtab, &relro);
+  if (relro.writable)
+    mprotect((void*)relro.start, relro.end - relro.start, PROT_READ);
+  return 0;
+}
+
+void lfi_runtime_patch(void)
+{
+  if (!lfi_function_count)
+    return;
+  pthread_mutex_lock(&patch_lock);
+  if (trampolines || 0 == write_trampolines())
+    dl_iterate_phdr(patch_object, NULL);
+  else
+    printf("LFI: unable to map the trampolines, nothing is intercepted\n");
+  pthread_mutex_unlock(&patch_lock);
+}
+
+/* objects loaded later get their imports patched as well */
+void* lfi_runtime_dlopen(const char* file, int mode)
+{
+  static void* (*original_dlopen)(const char*, int);
+  void* handle;
+
+  if (!original_dlopen)
+    original_dlopen = (void* (*)(const char*, int))dlsym(RTLD_NEXT, "dlopen");
+  handle = original_dlopen(file, mode);
+  if (handle && init_done)
+    lfi_runtime_patch();
+  return handle;
+}
+
+extern "C" void* dlopen(const char* file, int mode)
+{
+  return lfi_runtime_dlopen(file, mode);
+}
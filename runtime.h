@@ -0,0 +1,57 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   prebuilt runtime, liblfi_runtime.so (Linux x86_64)
+
+   The same library as the stubs libfi generates and compiles for each
+   plan, built once with -DLFI_RUNTIME and without a stub file: it maps
+   the plan named by $LFI_PLAN, compiled by libfi -r (see planfile.h),
+   when it is loaded and fills the tables the stub file would define
+   (function ids, function_info rows, triggers).
+   Instead of defining the intercepted symbols, it writes a small
+   trampoline for each of them in an executable page (the equivalent of
+   GENERATE_TRAMPOLINE_x64) and points the GOT entries of every loaded
+   object that imports the symbol at it. Objects loaded later with dlopen
+   are patched as well. Calls through pointers obtained with dlsym are not
+   intercepted
+*/
+
+#define LFI_PLAN_ENV  "LFI_PLAN"
+
+/* capacity of the plan tables */
+#define LFI_RUNTIME_MAX_FUNCTIONS  512
+#define LFI_RUNTIME_MAX_TRIGGERS   1024
+
+/* maps $LFI_PLAN, 0 on success. Until then, nothing is intercepted */
+int lfi_runtime_load(void);
+/* points the imports of the intercepted symbols at the trampolines */
+void lfi_runtime_patch(void);
+/*
+   dlopen, then lfi_runtime_patch. Also the original of dlopen when the
+   plan intercepts it, whose imports point at its trampoline instead
+*/
+void* lfi_runtime_dlopen(const char* file, int mode);
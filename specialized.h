@@ -0,0 +1,120 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+/*
+   building blocks of the stubs generated by libfi -s (specialized mode)
+
+   Instead of walking function_info_<name> and calling every trigger
+   through Trigger::Evaluate, each intercepted function gets a decision
+   function that evaluates its rows in plan order, each row being an
+   LfiRow of the row's trigger classes. The calls are not virtual, so the
+   compiler can inline the AND-chain; the triggers below are specialized
+   further, with their plan arguments as template arguments. The trigger
+   objects are still created and initialized by the runtime (the plan is
+   fixed, not the trigger state), and rows are still skipped when they
+   are disarmed
+*/
+
+/* the stubs may be built at -O0 (see compile_command), the decision functions need the inliner */
+#pragma GCC optimize ("O2")
+
+/* inter.h's annotations clash with the standard library's parameter names */
+#undef __in
+#undef __out
+
+#include <utility>
+
+#include "Trigger.h"
+#include "triggers/CallCountTrigger.h"
+#include "triggers/SingleTrigger.h"
+
+/* a trigger whose class isn't known when the stub is generated */
+struct LfiVirtual
+{
+  static bool Evaluate(Trigger* t, const CallContext& ctx)
+  {
+    return t->Evaluate(ctx);
+  }
+};
+
+/* a trigger of class T, called without virtual dispatch */
+template <class T>
+struct LfiDirect
+{
+  static bool Evaluate(Trigger* t, const CallContext& ctx)
+  {
+    return static_cast<T*>(t)->T::Evaluate(ctx);
+  }
+};
+
+/* CallCountTrigger, with the <callcount> values folded in */
+template <long... Counts>
+struct LfiCallCount
+{
+  static bool Evaluate(Trigger* t, const CallContext&)
+  {
+    CallCountTrigger* cc = static_cast<CallCountTrigger*>(t);
+    long n;
+
+    n = cc->NextCall();
+    cc->CheckLastCall(n);
+    return ((n == Counts) || ...);
+  }
+};
+
+struct LfiSingle
+{
+  static bool Evaluate(Trigger* t, const CallContext&)
+  {
+    return static_cast<SingleTrigger*>(t)->Fire();
+  }
+};
+
+/*
+   one row of a function: true if all its triggers evaluate to true (a
+   row without triggers always does). A trigger whose class wasn't found
+   disables the row, like in determine_action
+*/
+template <class... Ts>
+struct LfiRow
+{
+  template <size_t... I>
+  static bool All(TriggerDesc* const* d, const CallContext& ctx, std::index_sequence<I...>)
+  {
+    return ((d[I]->trigger && Ts::Evaluate(d[I]->trigger, ctx)) && ...);
+  }
+
+  static bool Evaluate(TriggerDesc* const* d, const CallContext& ctx)
+  {
+    return All(d, ctx, std::index_sequence_for<Ts...>());
+  }
+};
+
+/* the row of function_id that fires, if it is armed */
+#define LFI_SPECIALIZED_ROW(FUNCTION_ID, ROW, TRIGGER_LIST, ...) \
+  if ((lfi_armed[FUNCTION_ID] & LFI_ROW_BIT(ROW)) && \
+      LfiRow< __VA_ARGS__ >::Evaluate(TRIGGER_LIST, ctx)) \
+    return ROW;
@@ -5,108 +5,120 @@
 #include <stdarg.h>
 #include <execinfo.h>
 #include <string.h>
+#include <stdlib.h>
+#include <iostream>
 
 using namespace std;
 
 AfterUnlockTrigger::AfterUnlockTrigger()
+  : base(0)
+  , haveBase(false)
+  , baseGeneration(~0UL)
 {
+  pthread_mutex_init(&baseLock, NULL);
+  unlockId = lfi_lookup_function("pthread_mutex_unlock");
+  exitId = lfi_lookup_function("pthread_exit");
+  haveKey = (0 == pthread_key_create(&lastUnlockKey, free));
 }
 
-void AfterUnlockTrigger::Init(xmlNodePtr initData)
+AfterUnlockTrigger::UnlockInfo* AfterUnlockTrigger::GetSlot(bool create)
 {
-  xmlNodePtr nodeElement, textElement;
+  UnlockInfo* ui;
 
-  nodeElement = initData->children;
-  while (nodeElement)
+  if (!haveKey)
+    return NULL;
+  ui = (UnlockInfo*)pthread_getspecific(lastUnlockKey);
+  if (!ui && create)
   {
-    if (XML_ELEMENT_NODE == nodeElement->type)
+    ui = (UnlockInfo*)malloc(sizeof(UnlockInfo));
+    if (ui && pthread_setspecific(lastUnlockKey, ui))
     {
-      textElement = nodeElement->children;
-      if (XML_TEXT_NODE == textElement->type) {
-        if (!xmlStrcmp(nodeElement->name, (const xmlChar*)"lines"))
-          lineCount = atoi((char*)textElement->content);
-        else if (!xmlStrcmp(nodeElement->name, (const xmlChar*)"module"))
-          exePath = (char*)textElement->content;
-      }
+      free(ui);
+      ui = NULL;
     }
-    nodeElement = nodeElement->next;
   }
+  return ui;
 }
 
-struct layout
+void AfterUnlockTrigger::Init(const TriggerArg* args)
 {
-  struct layout *ebp;
-  void *ret;
-};
+  const TriggerArg* arg;
+
+  for (arg = args ? args->children : NULL; arg; arg = arg->next)
+  {
+    if (!arg->text[0])
+      continue;
+    if (!strcmp(arg->name, "lines"))
+      lineCount = arg->value;
+    else if (!strcmp(arg->name, "module"))
+      exePath = arg->text;
+  }
 
+  if (exePath.empty())
+    exePath = "/proc/self/exe";
+  if (!lines.Load(exePath.c_str()))
+    cerr << "[AfterUnlockTrigger] No line tables in " << exePath << endl;
+  ResolveBase();
+}
 
-bool get_file_line(const char* binary, unsigned long address, char* src, int* line)
+void AfterUnlockTrigger::ResolveBase()
 {
-  int pipefd[2];
-  char addr2linecmd[1024];
-  
-  char buffer[1024];
-  ssize_t readc;
-
-  char* colon;
-
-  src[0] = 0;
-  if (-1 != pipe(pipefd)) {
-    sprintf(addr2linecmd, "addr2line -e %s %lx 1>&%d", binary, address, pipefd[1]);
-    system(addr2linecmd);
-    close(pipefd[1]);
-
-    readc = read(pipefd[0], buffer, sizeof(buffer));
-    buffer[readc] = 0;
-    close(pipefd[0]);
-
-    colon = strchr(buffer, ':');
-    if (colon) {
-      colon[0] = 0;
-      strcpy(src, buffer);
-      *line = atoi(colon+1);
+  unsigned long generation;
+  uintptr_t b;
+
+  pthread_mutex_lock(&baseLock);
+  /* read first: an object loaded during the lookup bumps it again */
+  generation = lfi_objects_generation();
+  if (baseGeneration != generation)
+  {
+    if (lfi_object_base(exePath.c_str(), &b))
+    {
+      /* published before haveBase, for the threads that don't take the lock */
+      __atomic_store_n(&base, b, __ATOMIC_RELAXED);
+      __atomic_store_n(&haveBase, true, __ATOMIC_RELEASE);
     }
+    else
+      __atomic_store_n(&haveBase, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&baseGeneration, generation, __ATOMIC_RELEASE);
   }
-
-  if (0 == src[0] || 0 == strcmp(src, "??"))
-    return false;
-  return true;
+  pthread_mutex_unlock(&baseLock);
 }
 
 
-bool AfterUnlockTrigger::Eval(const string* functionName, ...)
+bool AfterUnlockTrigger::Evaluate(const CallContext& ctx)
 {
-  map<pthread_t, UnlockInfo>::iterator it;
+  UnlockInfo *last;
   UnlockInfo ui;
-  pthread_t self;
-
-  // XXX assuming stack frames & arch dependent
-  register void *ebpx __asm__ ("ebp");
-  struct layout *ebp = (struct layout *)ebpx;
+  void *ret;
 
-  // reaching to the function calling the interceptor
-  ebp = ebp->ebp->ebp;
+  // frame 0 is the function calling the interceptor; for mysql, look one
+  // frame further up to skip the wrappers
+  ret = ctx.ReturnAddress(1);
 
-  // for mysql, go one more time to skip the wrappers
-  ebp = ebp->ebp;
-  
-  if (*functionName == "pthread_exit")
+  if (ctx.functionId == exitId)
   {
-    it = lastUnlockInfo.find(self);
-    if (it != lastUnlockInfo.end())
-      lastUnlockInfo.erase(it);
+    /* the key's destructor frees the slot */
+    if ((last = GetSlot(false)))
+      last->file = NULL;
+    return false;
   }
-  // run addr2line -e executable ebp->ret
-  else if (get_file_line(exePath.c_str(), (unsigned long)ebp->ret, ui.file, &ui.line)) {
-    self = pthread_self();
 
-    if (*functionName == "pthread_mutex_unlock")
+  /* the module may be loaded (or unloaded) after the trigger is initialized */
+  if (__atomic_load_n(&baseGeneration, __ATOMIC_ACQUIRE) != lfi_objects_generation())
+    ResolveBase();
+  if (!__atomic_load_n(&haveBase, __ATOMIC_ACQUIRE))
+    return false;
+  // the line of the call instruction, just before ret
+  if (ret && lines.Lookup((uintptr_t)ret - 1 - __atomic_load_n(&base, __ATOMIC_RELAXED),
+                          &ui.file, &ui.line)) {
+    if (ctx.functionId == unlockId)
     {
-      lastUnlockInfo[self] = ui;
+      if ((last = GetSlot(true)))
+        *last = ui;
     }
     else
     {
-      it = lastUnlockInfo.find(self);
+      last = GetSlot(false);
 /*      
       if (it != lastUnlockInfo.end())
       {  ofstream outf("/home/paul/kk");
@@ -116,9 +128,10 @@ bool AfterUnlockTrigger::Eval(const string* functionName, ...)
         outf.close();
       }
 */      
-      if (it != lastUnlockInfo.end()) {
-        if (0 == strcmp(it->second.file, ui.file) && 
-          ui.line - it->second.line < lineCount)
+      if (last && last->file) {
+        /* one pointer per file name (see LineTable::Lookup) */
+        if (last->file == ui.file &&
+          ui.line - last->line < lineCount)
           return true;
       }
     }
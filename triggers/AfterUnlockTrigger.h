@@ -1,5 +1,6 @@
 
 #include "../Trigger.h"
+#include "../linetable.h"
 #include <pthread.h>
 
 //#define exePath    "/home/paul/mysql-5.1.44/sql/mysqld"
@@ -8,17 +9,33 @@ DEFINE_TRIGGER( AfterUnlockTrigger )
 {
 public:
   struct UnlockInfo {
-    char file[256];
+    const char* file; /* from lines, NULL if none */
     int line;
   };
 
 public:
   AfterUnlockTrigger();
-  void Init(xmlNodePtr initData);
-  bool Eval(const string* functionName, ...);
+  void Init(const TriggerArg* args);
+  bool Evaluate(const CallContext& ctx);
+  bool ObservesCalls() const { return true; } /* records the last unlock */
 
 private:
   int lineCount;
   string exePath;
-  map<pthread_t, UnlockInfo> lastUnlockInfo;
+  /* exePath's line tables, read once, and where it is loaded */
+  LineTable lines;
+  uintptr_t base;
+  bool haveBase; /* set after base is stored, cleared if the module is unloaded */
+  /* looks the base up again when objects were loaded or unloaded since */
+  void ResolveBase();
+  unsigned long baseGeneration; /* lfi_objects_generation at the last lookup */
+  pthread_mutex_t baseLock;
+  FunctionId unlockId, exitId;
+  /*
+     the last unlock of each thread, in a slot only that thread touches
+     (allocated on its first unlock, freed when it exits)
+  */
+  UnlockInfo* GetSlot(bool create);
+  pthread_key_t lastUnlockKey;
+  bool haveKey;
 };
@@ -26,37 +26,57 @@
 
 #include "CallCountTrigger.h"
 #include <iostream>
+#include <string.h>
 
 CallCountTrigger::CallCountTrigger()
   : callCount(0)
+  , perThread(false)
+  , maxCallCount(0)
 {
 }
 
-void CallCountTrigger::Init(xmlNodePtr initData)
+void CallCountTrigger::Init(const TriggerArg* args)
 {
-  xmlNodePtr nodeElement, textElement;
+  const TriggerArg* arg;
 
-  nodeElement = initData->children;
-  while (nodeElement)
+  for (arg = args ? args->children : NULL; arg; arg = arg->next)
   {
-    if (XML_ELEMENT_NODE == nodeElement->type &&
-      !xmlStrcmp(nodeElement->name, (const xmlChar*)"callcount"))
-    {
-      textElement = nodeElement->children;
-      if (XML_TEXT_NODE == textElement->type)
-        callCounts.push_back(atoi((char*)textElement->content));
-    }
-    nodeElement = nodeElement->next;
+    if (!strcmp(arg->name, "callcount") && arg->text[0])
+      callCounts.push_back(arg->value);
+    /* <perthread/>: count the calls made by each thread separately */
+    else if (!strcmp(arg->name, "perthread"))
+      perThread = (0 == pthread_key_create(&countKey, NULL));
   }
+
+  for (vector<int>::iterator it = callCounts.begin(), itend = callCounts.end(); it != itend; ++it)
+    if (*it > maxCallCount)
+      maxCallCount = *it;
+}
+
+/* "count": the number of calls seen so far, e.g. 0 to start over */
+bool CallCountTrigger::SetParam(const char* name, long value)
+{
+  if (strcmp(name, "count") || perThread)
+    return false;
+
+  __sync_lock_test_and_set(&callCount, value);
+  if (value < maxCallCount)
+    Rearm();
+  else
+    Disarm();
+  return true;
 }
 
-bool CallCountTrigger::Eval(const string*, ...)
+bool CallCountTrigger::Evaluate(const CallContext&)
 {
-  ++callCount;
+  long n;
+
+  n = NextCall();
+  CheckLastCall(n);
   // binary search? not useful for a reasonably small number of call counts
   for (vector<int>::iterator it = callCounts.begin(), itend = callCounts.end(); it != itend; ++it)
   {
-    if (callCount == *it) {
+    if (n == *it) {
       return true;
     }
   }
@@ -25,14 +25,42 @@
 */
 
 #include "../Trigger.h"
+#include <pthread.h>
 
 DEFINE_TRIGGER( CallCountTrigger )
 {
 public:
   CallCountTrigger();
-  void Init(xmlNodePtr initData);
-  bool Eval(const string* functionName, ...);
+  void Init(const TriggerArg* args);
+  bool Evaluate(const CallContext& ctx);
+  bool ObservesCalls() const { return true; } /* counts every call */
+  bool SetParam(const char* name, long value);
+
+  /* the number of this call, each one is handed out to exactly one caller */
+  long NextCall()
+  {
+    long n;
+
+    if (!perThread)
+      return __sync_add_and_fetch(&callCount, 1);
+
+    n = (long)pthread_getspecific(countKey) + 1;
+    pthread_setspecific(countKey, (void*)n);
+    return n;
+  }
+
+  /* past the last call count the trigger can't fire anymore (in no thread) */
+  void CheckLastCall(long n)
+  {
+    if (!perThread && n >= maxCallCount)
+      Disarm();
+  }
+
 private:
-  int callCount;
+  /* shared by all threads, or 0 and a count per thread in countKey */
+  volatile long callCount;
+  bool perThread;
+  pthread_key_t countKey;
+  int maxCallCount;
   vector<int> callCounts;
 };
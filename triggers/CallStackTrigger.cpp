@@ -0,0 +1,419 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+#include "CallStackTrigger.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#ifndef __APPLE__
+#include <link.h>
+#endif
+
+/* at most one bit per frame in a CallStackRange mask */
+#define MAX_FRAMES  64
+
+CallStackTrigger::CallStackTrigger()
+  : depth(LFI_STACK_DEPTH)
+  , table(NULL)
+{
+  pthread_mutex_init(&refreshLock, NULL);
+}
+
+void CallStackTrigger::Init(const TriggerArg* args)
+{
+  const TriggerArg *arg, *field;
+  CallStackFrame frame;
+
+  for (arg = args ? args->children : NULL; arg; arg = arg->next)
+  {
+    if (!strcmp(arg->name, "depth") && arg->value > 0)
+      depth = arg->value < LFI_STACK_DEPTH ? arg->value : LFI_STACK_DEPTH;
+    if (strcmp(arg->name, "frame"))
+      continue;
+
+    frame.module = frame.file = "";
+    frame.offset = 0;
+    frame.haveOffset = false;
+    frame.line = 0;
+    frame.reported = false;
+    for (field = arg->children; field; field = field->next)
+    {
+      if (!field->text[0])
+        continue;
+      if (!strcmp(field->name, "module"))
+        frame.module = field->text;
+      else if (!strcmp(field->name, "offset"))
+      {
+        frame.offset = strtoul(field->text, NULL, 16);
+        frame.haveOffset = true;
+      }
+      else if (!strcmp(field->name, "file"))
+        frame.file = field->text;
+      else if (!strcmp(field->name, "line"))
+        frame.line = field->value;
+    }
+
+    if (frames.size() == MAX_FRAMES)
+    {
+      cerr << "[CallStackTrigger] Only " << MAX_FRAMES << " frames are supported" << endl;
+      break;
+    }
+    frames.push_back(frame);
+  }
+
+  Refresh();
+}
+
+/************************************************************************/
+/* the table                                                            */
+/************************************************************************/
+
+#ifndef __APPLE__
+struct loaded_object
+{
+  string name;
+  uintptr_t base;
+  vector< pair<uintptr_t, uintptr_t> > text; /* executable segments */
+};
+
+static int list_object(struct dl_phdr_info* info, size_t, void* data)
+{
+  vector<loaded_object>* objects = (vector<loaded_object>*)data;
+  loaded_object object;
+  int i;
+
+  object.name = info->dlpi_name ? info->dlpi_name : "";
+  object.base = info->dlpi_addr;
+  for (i = 0; i < info->dlpi_phnum; ++i)
+    if (PT_LOAD == info->dlpi_phdr[i].p_type && (info->dlpi_phdr[i].p_flags & PF_X))
+      object.text.push_back(make_pair(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr,
+                                      info->dlpi_addr + info->dlpi_phdr[i].p_vaddr +
+                                      info->dlpi_phdr[i].p_memsz));
+  if (!object.text.empty())
+    objects->push_back(object);
+  return 0;
+}
+#endif
+
+static const char* base_name(const string& path)
+{
+  size_t slash = path.find_last_of('/');
+
+  return path.c_str() + (slash == string::npos ? 0 : slash + 1);
+}
+
+/* the object at path (its path, real path or file name) is module */
+static bool same_module(const string& module, const string& path, const string& real)
+{
+  if (module == path || module == real)
+    return true;
+  if (string::npos != module.find('/'))
+    return false;
+  return module == base_name(path) || module == base_name(real);
+}
+
+/*
+   the length of the call instruction at code, 0 if there is none: a
+   direct call or an indirect one through a register or memory operand
+*/
+static int call_length(const unsigned char* code)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  int n, mod, rm;
+
+  n = 0;
+  if (0x3e == code[n]) /* notrack */
+    ++n;
+#ifdef __x86_64__
+  if (code[n] >= 0x40 && code[n] <= 0x4f) /* REX */
+    ++n;
+#endif
+  if (0xe8 == code[n])
+    return n + 5;
+  if (0xff != code[n] || 2 != ((code[n + 1] >> 3) & 7))
+    return 0;
+
+  mod = code[n + 1] >> 6;
+  rm = code[n + 1] & 7;
+  n += 2;
+  if (3 == mod)
+    return n;
+  if (4 == rm && 0 == mod && 5 == (code[n] & 7))
+    return n + 1 + 4;
+  if (4 == rm)
+    ++n;
+  if (0 == mod && 5 == rm)
+    return n + 4;
+  return n + (1 == mod ? 1 : 2 == mod ? 4 : 0);
+#else
+  return 0;
+#endif
+}
+
+CallStackTable* CallStackTrigger::Build(unsigned long generation)
+{
+  CallStackTable* t = new CallStackTable;
+#ifndef __APPLE__
+  vector<loaded_object> loaded;
+  vector<CallStackRange> raw;
+  vector<uintptr_t> bounds;
+  CallStackRange range;
+  vector< pair<uintptr_t, uintptr_t> > lineRanges;
+  LineTable* lines;
+  char real[PATH_MAX];
+  string path;
+  uintptr_t call;
+  uint64_t moduleMask;
+  size_t o, s, f, b, r;
+  bool covered;
+  int length;
+
+  t->generation = generation;
+  dl_iterate_phdr(list_object, &loaded);
+
+  for (o = 0; o < loaded.size(); ++o)
+  {
+    /* the main program has no name */
+    path = loaded[o].name.empty() ? "/proc/self/exe" : loaded[o].name;
+    if (!realpath(path.c_str(), real))
+      strcpy(real, path.c_str());
+    if (loaded[o].name.empty())
+      path = real;
+
+    moduleMask = 0;
+    for (f = 0; f < frames.size(); ++f)
+    {
+      if (!same_module(frames[f].module, path, real))
+        continue;
+      if (!frames[f].haveOffset && frames[f].file.empty())
+      {
+        moduleMask |= 1ULL << f;
+        continue;
+      }
+      if (!frames[f].haveOffset)
+      {
+        /* the code of the line, from the module's line tables (read once) */
+        if (!(lines = lineTables[real]))
+        {
+          lines = lineTables[real] = new LineTable;
+          lines->Load(real);
+        }
+        lineRanges.clear();
+        lines->Ranges(frames[f].file.c_str(), frames[f].line, lineRanges);
+        if (lineRanges.empty() && !frames[f].reported)
+        {
+          frames[f].reported = true;
+          cerr << "[CallStackTrigger] No code for " << frames[f].file << ":" << frames[f].line
+               << " in " << real << endl;
+        }
+        for (r = 0; r < lineRanges.size(); ++r)
+        {
+          range.start = loaded[o].base + lineRanges[r].first;
+          range.end = loaded[o].base + lineRanges[r].second;
+          range.mask = 1ULL << f;
+          raw.push_back(range);
+        }
+        continue;
+      }
+
+      /* the call site, found in the object's code once and for all */
+      call = loaded[o].base + frames[f].offset;
+      for (s = 0; s < loaded[o].text.size(); ++s)
+      {
+        if (call < loaded[o].text[s].first || call >= loaded[o].text[s].second)
+          continue;
+        length = call + 16 <= loaded[o].text[s].second ? call_length((const unsigned char*)call) : 0;
+        /* no call there: offset is the return address */
+        range.start = length ? call : call - 1;
+        range.end = length ? call + length : call;
+        range.mask = 1ULL << f;
+        raw.push_back(range);
+      }
+    }
+
+    for (s = 0; s < loaded[o].text.size(); ++s)
+    {
+      range.start = loaded[o].text[s].first;
+      range.end = loaded[o].text[s].second;
+      range.mask = moduleMask;
+      raw.push_back(range);
+    }
+  }
+
+  /* call sites lie within the objects: split the overlaps into disjoint ranges */
+  for (r = 0; r < raw.size(); ++r)
+  {
+    bounds.push_back(raw[r].start);
+    bounds.push_back(raw[r].end);
+  }
+  sort(bounds.begin(), bounds.end());
+  bounds.erase(unique(bounds.begin(), bounds.end()), bounds.end());
+  for (b = 0; b + 1 < bounds.size(); ++b)
+  {
+    range.start = bounds[b];
+    range.end = bounds[b + 1];
+    range.mask = 0;
+    covered = false;
+    for (r = 0; r < raw.size(); ++r)
+      if (raw[r].start <= range.start && range.end <= raw[r].end)
+      {
+        range.mask |= raw[r].mask;
+        covered = true;
+      }
+    if (!covered)
+      continue;
+    if (!t->ranges.empty() && t->ranges.back().end == range.start &&
+        t->ranges.back().mask == range.mask)
+      t->ranges.back().end = range.end;
+    else
+      t->ranges.push_back(range);
+  }
+#endif
+  return t;
+}
+
+/*
+   the tables replaced by Refresh, of every trigger: another thread may
+   still be searching them, so they are only freed when the target exits
+*/
+static pthread_mutex_t retiredLock = PTHREAD_MUTEX_INITIALIZER;
+static vector<CallStackTable*>* retired;
+
+static void free_retired(void)
+{
+  size_t i;
+
+  pthread_mutex_lock(&retiredLock);
+  for (i = 0; i < retired->size(); ++i)
+    delete (*retired)[i];
+  retired->clear();
+  pthread_mutex_unlock(&retiredLock);
+}
+
+static void retire(CallStackTable* t)
+{
+  pthread_mutex_lock(&retiredLock);
+  if (!retired)
+  {
+    retired = new vector<CallStackTable*>;
+    atexit(free_retired);
+  }
+  retired->push_back(t);
+  pthread_mutex_unlock(&retiredLock);
+}
+
+void CallStackTrigger::Refresh()
+{
+  CallStackTable *t, *old;
+  unsigned long generation;
+
+  pthread_mutex_lock(&refreshLock);
+  /* read first: an object loaded while building bumps it again */
+  generation = lfi_objects_generation();
+  old = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+  if (!old || old->generation != generation)
+  {
+    t = Build(generation);
+    /* the ranges are complete before any thread can see the table */
+    __atomic_store_n(&table, t, __ATOMIC_RELEASE);
+    if (old)
+      retire(old);
+  }
+  pthread_mutex_unlock(&refreshLock);
+}
+
+/************************************************************************/
+/* evaluation                                                           */
+/************************************************************************/
+
+bool CallStackTrigger::Match(const CallStackTable* t, uintptr_t address, uint64_t* mask) const
+{
+  size_t low, high, middle;
+
+  /* the first range that ends after address */
+  low = 0;
+  high = t->ranges.size();
+  while (low < high)
+  {
+    middle = (low + high) / 2;
+    if (t->ranges[middle].end <= address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if (low == t->ranges.size() || t->ranges[low].start > address)
+    return false;
+  *mask = t->ranges[low].mask;
+  return true;
+}
+
+bool CallStackTrigger::Evaluate(const CallContext& ctx)
+{
+  const CallStackTable* t;
+  void *ret, *fp;
+  uint64_t mask;
+  bool framePointers;
+  size_t next;
+  int frame;
+
+  if (frames.empty())
+    return false;
+
+  t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+  /* an object was loaded or unloaded since the table was built */
+  if (t->generation != lfi_objects_generation())
+  {
+    Refresh();
+    t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+  }
+  /* without a frame pointer chain, fall back to the unwinder */
+  framePointers = (NULL != ctx.FramePointer(0));
+  next = 0;
+  ret = ctx.returnAddress;
+  for (frame = 0; ret && frame < depth; )
+  {
+    /* the call instruction is the one before the return address */
+    if (!Match(t, (uintptr_t)ret - 1, &mask))
+      mask = 0;
+
+    if (mask & (1ULL << next))
+    {
+      if (++next == frames.size())
+        return true;
+    }
+
+    /* frame i's saved frame pointer is followed by the return address of frame i + 1 */
+    if (framePointers)
+      ret = (fp = ctx.FramePointer(frame)) ? ((void**)fp)[1] : NULL;
+    else
+      ret = ctx.ReturnAddress(frame + 1);
+    ++frame;
+  }
+  return false;
+}
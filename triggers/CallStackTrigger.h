@@ -0,0 +1,102 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+#include "../Trigger.h"
+#include "../linetable.h"
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+   fires when the call comes from the given stack frames. <args> holds a
+   <frame> per frame to look for, innermost first, e.g.
+
+     <frame><module>libpq.so.5</module></frame>
+     <frame><module>/usr/bin/psql</module><offset>0x4a2f</offset></frame>
+
+   <module> is the path, real path or file name of a loaded object; alone,
+   it matches any return address in that object. <offset> narrows it to
+   one call site: the call instruction at that address of the object (as
+   cs-analyzer writes them), or the return address if there is no call
+   there. <file> and <line> name a call site by its source line instead,
+   found in the module's line tables (see linetable.h) when it's loaded.
+   The frames must match return addresses of the stack in this order, each
+   further up than the previous one; <depth> is how many frames to examine
+   (LFI_STACK_DEPTH by default)
+*/
+
+struct CallStackFrame
+{
+  string module;
+  uintptr_t offset;
+  bool haveOffset;
+  string file;
+  int line;
+  bool reported; /* no code for file:line, said once */
+};
+
+/* the addresses [start, end) match the frames whose bit is set in mask */
+struct CallStackRange
+{
+  uintptr_t start;
+  uintptr_t end;
+  uint64_t mask;
+};
+
+/*
+   the executable segments of every loaded object, as sorted disjoint
+   ranges tagged with the frames they match (possibly none). Built with
+   dl_iterate_phdr, never changed once published: the trigger swaps in a
+   new one when an object is loaded or unloaded, and frees the old one
+   when the target exits
+*/
+struct CallStackTable
+{
+  vector<CallStackRange> ranges;
+  unsigned long generation; /* lfi_objects_generation when it was built */
+};
+
+DEFINE_TRIGGER( CallStackTrigger )
+{
+public:
+  CallStackTrigger();
+  void Init(const TriggerArg* args);
+  bool Evaluate(const CallContext& ctx);
+
+private:
+  /* the frames the instruction at address matches, false outside every object */
+  bool Match(const CallStackTable* t, uintptr_t address, uint64_t* mask) const;
+  /* rebuilds the table if objects were loaded or unloaded since */
+  void Refresh();
+  CallStackTable* Build(unsigned long generation);
+
+  vector<CallStackFrame> frames;
+  int depth;
+  /* the line tables of the modules of <file> frames, by real path */
+  map<string, LineTable*> lineTables;
+  /* published with a release store, read with acquire */
+  CallStackTable* table;
+  pthread_mutex_t refreshLock;
+};
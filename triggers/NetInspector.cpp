@@ -1,6 +1,5 @@
 #include "NetInspector.h"
 #include <iostream>
-#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -32,31 +31,18 @@ NetInspector::NetInspector()
     exit(-2);
 }
 
-bool NetInspector::Eval(const string* functionName, ...)
+bool NetInspector::Evaluate(const CallContext& ctx)
 {
-  /* only intended to be used when intercepting the read function */
-  va_list ap;
-  int fd;
-  size_t size;
-
-  int socket_i;
-  char *message_i;
+  /*
+     intended to be used when intercepting send/sendto/recv-like functions:
+     (int socket, void* message, size_t length, int flags, ...)
+  */
   size_t length_i;
-  int flags_i;
-  struct sockaddr *dest_addr_i;
-  socklen_t dest_len_i;
 
-  va_start(ap, functionName);
-  socket_i = va_arg(ap, int);
-  message_i = va_arg(ap, char*);
-  length_i = va_arg(ap, size_t);  
-  flags_i = va_arg(ap, int);
-  dest_addr_i = va_arg(ap, struct sockaddr *);
-  dest_len_i = va_arg(ap, socklen_t);
-  va_end(ap);
+  length_i = (size_t)ctx.args[2];
 
   bzero(buffer,256);
-  sprintf(buffer, "%s %d",functionName->c_str(), (int)length_i);
+  sprintf(buffer, "%s %d", lfi_function_name(ctx.functionId), (int)length_i);
   int n = write(sockfd,buffer,strlen(buffer));
   if (n < 0) 
     exit(-3);
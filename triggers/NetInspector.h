@@ -10,7 +10,8 @@ DEFINE_TRIGGER( NetInspector )
 {
 public:
   NetInspector();
-  bool Eval(const string* functionName, ...);
+  bool Evaluate(const CallContext& ctx);
+  bool ObservesCalls() const { return true; } /* asks the server about every call */
 private:
   int sockfd;  
   char buffer[256];
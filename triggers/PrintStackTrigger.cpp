@@ -8,34 +8,28 @@ PrintStackTrigger::PrintStackTrigger()
 {
 }
 
-void PrintStackTrigger::Init(xmlNodePtr initData)
+void PrintStackTrigger::Init(const TriggerArg* args)
 {
-  xmlNodePtr nodeElement, textElement;
+  const TriggerArg* arg;
 
-  nodeElement = initData->children;
-  while (nodeElement)
+  for (arg = args ? args->children : NULL; arg; arg = arg->next)
   {
-    if (XML_ELEMENT_NODE == nodeElement->type &&
-      !xmlStrcmp(nodeElement->name, (const xmlChar*)"file"))
+    if (!strcmp(arg->name, "file") && arg->text[0])
     {
-      textElement = nodeElement->children;
-      if (XML_TEXT_NODE == textElement->type)
-      {
-        remove((char*)textElement->content);
-        file = fopen((char*)textElement->content,"a");        
-      }
+      remove(arg->text);
+      file = fopen(arg->text, "a");
     }
-    nodeElement = nodeElement->next;
   }
 }
 
-bool PrintStackTrigger::Eval(const string*, ...)
+bool PrintStackTrigger::Evaluate(const CallContext& ctx)
 {
   void *array[10];
-    size_t size;
+  int size;
 
-  size = backtrace(array, 10);  
-  backtrace_symbols_fd(array, size, fileno(file));
-  fclose(file);
+  /* shared with the other triggers of the call */
+  size = ctx.Backtrace(array, 10);
+  if (file)
+    backtrace_symbols_fd(array, size, fileno(file));
   return true;
 }
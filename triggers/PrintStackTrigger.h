@@ -5,8 +5,9 @@ DEFINE_TRIGGER( PrintStackTrigger )
 {
 public:
   PrintStackTrigger();
-  void Init(xmlNodePtr initData);
-  bool Eval(const string* functionName, ...);
+  void Init(const TriggerArg* args);
+  bool Evaluate(const CallContext& ctx);
+  bool ObservesCalls() const { return true; } /* prints every call */
 private:
   FILE* file;
 };
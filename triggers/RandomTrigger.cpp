@@ -25,47 +25,140 @@
 */
 
 #include "RandomTrigger.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
-#include <fstream>
+#include <unistd.h>
 #include <iostream>
+#include "../inter.h"
 
-unsigned int RandomTrigger::seed = 0;
+#define MILLION  1000000
+
+uint64_t RandomTrigger::seed = 0;
+bool RandomTrigger::seeded = false;
+bool RandomTrigger::experimentSeeded = false;
+volatile long RandomTrigger::threads = 0;
 
 RandomTrigger::RandomTrigger()
-  : probability(0)
+  : ppm(0)
+{
+}
+
+/* from the text of <percent>, which may have decimals */
+static uint32_t percent_ppm(const char* text)
 {
+  double percent = strtod(text, NULL);
+
+  if (percent <= 0)
+    return 0;
+  return percent >= 100 ? MILLION : (uint32_t)(percent * (MILLION / 100) + 0.5);
 }
 
-void RandomTrigger::Init(xmlNodePtr initData)
+void RandomTrigger::SetSeed(uint64_t value)
 {
-  xmlNodePtr nodeElement, textElement;
-  time_t t;
-  const char* seedFile = "rndtrigger.seed";
+  FILE* f;
 
-  nodeElement = initData->children;
-  while (nodeElement)
+  seed = value;
+  seeded = true;
+  if ((f = fopen(RANDOM_SEED_FILE, "w")))
   {
-    if (XML_ELEMENT_NODE == nodeElement->type &&
-      !xmlStrcmp(nodeElement->name, (const xmlChar*)"percent"))
+    fprintf(f, "%llu\n", (unsigned long long)seed);
+    fclose(f);
+  }
+}
+
+void RandomTrigger::Init(const TriggerArg* args)
+{
+  const TriggerArg* arg;
+  const char* env;
+  bool planSeed = false;
+
+  for (arg = args ? args->children : NULL; arg; arg = arg->next)
+  {
+    if (!arg->text[0])
+      continue;
+    if (!strcmp(arg->name, "percent"))
+      ppm = percent_ppm(arg->text);
+    else if (!strcmp(arg->name, "ppm"))
+      ppm = arg->value < 0 ? 0 : arg->value > MILLION ? MILLION : arg->value;
+    else if (!strcmp(arg->name, "seed"))
     {
-      textElement = nodeElement->children;
-      if (XML_TEXT_NODE == textElement->type)
-        probability = atoi((char*)textElement->content);
+      /* every trigger is initialized before the first call, the plan's seed wins */
+      SetSeed(strtoull(arg->text, NULL, 0));
+      planSeed = true;
     }
-    nodeElement = nodeElement->next;
   }
-  
-  if (!seed)
+
+  if (seeded || planSeed)
+    return;
+  if ((env = getenv(RANDOM_SEED_ENV)) && env[0])
+    SetSeed(strtoull(env, NULL, 0));
+  else
+    SetSeed(((uint64_t)time(NULL) << 20) ^ getpid());
+}
+
+bool RandomTrigger::SetParam(const char* name, long value)
+{
+  if (!strcmp(name, "percent"))
+    value *= MILLION / 100;
+  else if (strcmp(name, "ppm"))
+    return false;
+  ppm = value < 0 ? 0 : value > MILLION ? MILLION : value;
+  return true;
+}
+
+/* splitmix64, spreads seed + thread index over the whole state */
+static uint64_t mix(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+uint64_t RandomTrigger::Next()
+{
+  /* in the runtime's TLS block, so no __tls_get_addr in the -fPIC stub */
+  uint64_t& state = lfi_thread.random;
+  uint64_t x;
+
+  /* the first draw of a thread: its stream is the next index's */
+  if (!state)
   {
-    seed = (unsigned)time(&t);
-    srand(seed);
+    state = mix(seed + mix(__sync_fetch_and_add(&threads, 1)));
+    if (!state)
+      state = 1;
   }
+
+  /* xorshift64* */
+  x = state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  state = x;
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+   the children of a fork server get the server's generators: every
+   experiment would draw the same numbers. Its seed goes to the
+   experiment's rndtrigger.seed, to replay it without the fork server
+*/
+void RandomTrigger::StartExperiment(unsigned experiment)
+{
+  if (experimentSeeded)
+    return;
+  experimentSeeded = true;
+  SetSeed(mix(seed ^ mix(experiment)));
+
+  /* only the forking thread exists, its stream starts over as index 0 */
+  threads = 0;
+  lfi_thread.random = 0;
 }
 
-bool RandomTrigger::Eval(const string*, ...)
+bool RandomTrigger::Evaluate(const CallContext&)
 {
-  if (rand() % 100 < probability)
-    return true;
-  return false;
+  /* the high 32 bits, scaled to [0, MILLION) */
+  return ((Next() >> 32) * MILLION >> 32) < ppm;
 }
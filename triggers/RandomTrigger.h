@@ -25,14 +25,40 @@
 */
 
 #include "../Trigger.h"
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+   fires with a fixed probability: <percent> (fractions allowed, e.g.
+   0.5) or <ppm>, parts per million. Every thread draws from its own
+   xorshift generator, seeded from one seed and the thread's index (in
+   the order threads first evaluate a RandomTrigger), so no lock is taken
+   and a run can be replayed. The seed is the plan's <seed>, else
+   $LFI_RANDOM_SEED, else derived from the time and pid; it is written
+   to rndtrigger.seed in either case. Each experiment of a fork server
+   draws from its own seed, derived from that one and its number
+*/
+
+#define RANDOM_SEED_ENV   "LFI_RANDOM_SEED"
+#define RANDOM_SEED_FILE  "rndtrigger.seed"
 
 DEFINE_TRIGGER( RandomTrigger )
 {
 public:
   RandomTrigger();
-  void Init(xmlNodePtr initData);
-  bool Eval(const string* functionName, ...);
+  void Init(const TriggerArg* args);
+  bool Evaluate(const CallContext& ctx);
+  bool ObservesCalls() const { return true; } /* draws a number for every call */
+  bool SetParam(const char* name, long value);
+  void StartExperiment(unsigned experiment);
 private:
-  int probability;
-  static unsigned int seed;
+  /* the next number of the calling thread's generator */
+  static uint64_t Next();
+  static void SetSeed(uint64_t value);
+
+  volatile uint32_t ppm;
+  static uint64_t seed;
+  static bool seeded;
+  static bool experimentSeeded; /* by the first trigger of the experiment */
+  static volatile long threads;
 };
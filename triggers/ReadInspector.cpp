@@ -26,24 +26,20 @@
 
 #include "ReadInspector.h"
 #include <iostream>
-#include <stdarg.h>
 
 ReadInspector::ReadInspector()
 {
 }
 
-bool ReadInspector::Eval(const string* functionName, ...)
+bool ReadInspector::Evaluate(const CallContext& ctx)
 {
   /* only intended to be used when intercepting the read function */
-  va_list ap;
   int fd;
   size_t size;
 
-  va_start(ap, functionName);
-  fd = va_arg(ap, int);
-  va_arg(ap, void*);
-  size = va_arg(ap, size_t);
-  va_end(ap);
+  /* read(int fd, void* buf, size_t count) */
+  fd = (int)ctx.args[0];
+  size = (size_t)ctx.args[2];
 
   /* inject only when reading 1024 bytes from stdin */
   return (fd == 0 && size == 1024);
@@ -37,6 +37,8 @@ __thread long SemTrigger::lockCount = 0;
 
 SemTrigger::SemTrigger()
 {
+  lockId = lfi_lookup_function("pthread_mutex_lock");
+  unlockId = lfi_lookup_function("pthread_mutex_unlock");
 #ifdef __APPLE__
   if (!lockCount_key)
     pthread_key_create(&lockCount_key, NULL);
@@ -62,14 +64,14 @@ void SemTrigger::set_lockCount(long v)
 }
 
 
-bool SemTrigger::Eval(const string* functionName, ...)
+bool SemTrigger::Evaluate(const CallContext& ctx)
 {
   long l;
-  if (*functionName == "pthread_mutex_lock")
+  if (ctx.functionId == lockId)
   {
     set_lockCount(get_lockCount()+1);
   }
-  else if (*functionName == "pthread_mutex_unlock")
+  else if (ctx.functionId == unlockId)
   {
     if ((l = get_lockCount())) // sanity check
       set_lockCount(l - 1);
@@ -31,10 +31,12 @@ DEFINE_TRIGGER( SemTrigger )
 {
 public:
   SemTrigger();
-  bool Eval(const string* functionName, ...);
+  bool Evaluate(const CallContext& ctx);
+  bool ObservesCalls() const { return true; } /* counts the locks held */
 private:
   long get_lockCount();
   void set_lockCount(long);
+  FunctionId lockId, unlockId;
 #ifdef __APPLE__
   static pthread_key_t lockCount_key;
 #else
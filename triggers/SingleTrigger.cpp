@@ -32,12 +32,7 @@ SingleTrigger::SingleTrigger()
   triggered = 0;
 }
 
-bool SingleTrigger::Eval(const string*, ...)
+bool SingleTrigger::Evaluate(const CallContext&)
 {
-  if (triggered) {
-    return false;
-  }
-
-  triggered = 1;
-  return true;
+  return Fire();
 }
@@ -30,7 +30,19 @@ DEFINE_TRIGGER( SingleTrigger )
 {
 public:
   SingleTrigger();
-  bool Eval(const string* functionName, ...);
+  bool Evaluate(const CallContext& ctx);
+  bool ObservesCalls() const { return true; } /* used up by the first call it sees */
+
+  bool Fire()
+  {
+    /* only the thread that flips it fires */
+    if (triggered || !__sync_bool_compare_and_swap(&triggered, 0, 1))
+      return false;
+    /* never fires again, let the stubs skip this trigger's rows */
+    Disarm();
+    return true;
+  }
+
 private:
-  unsigned int triggered;
+  volatile unsigned int triggered;
 };
@@ -28,107 +28,67 @@
 #include <string.h>
 #include <execinfo.h>
 #include <iostream>
-#ifdef __APPLE__
-#include <pthread.h>
-#endif
-
-#ifdef __x86_64__
-  #define REG_BP  "rbp"
-#else
-  #define REG_BP "ebp"
-#endif
-
 using namespace std;
-void StateTrigger::Init(xmlNodePtr initData)
+void StateTrigger::Init(const TriggerArg* args)
 {
-  xmlNodePtr nodeElement, nodeElementLvl2, textElement;
+  const TriggerArg *arg, *field;
 
-  nodeElement = initData->children;
-  while (nodeElement)
+  for (arg = args ? args->children : NULL; arg; arg = arg->next)
   {
-    if (XML_ELEMENT_NODE == nodeElement->type &&
-        (!xmlStrcmp(nodeElement->name, (const xmlChar*)"local") || !xmlStrcmp(nodeElement->name, (const xmlChar*)"global")))
+    if (!strcmp(arg->name, "local") || !strcmp(arg->name, "global"))
     {
       var.offset = 0;
       var.frame = 1;
-      var.location = (!xmlStrcmp(nodeElement->name, (const xmlChar*)"local") ? VAR_LOCAL : VAR_GLOBAL );
+      var.location = (!strcmp(arg->name, "local") ? VAR_LOCAL : VAR_GLOBAL );
 
-      nodeElementLvl2 = nodeElement->children;
-      while (nodeElementLvl2)
+      for (field = arg->children; field; field = field->next)
       {
-        textElement = nodeElementLvl2->children;
-        if (textElement && XML_TEXT_NODE == textElement->type)
-        {
-          if (!xmlStrcmp(nodeElementLvl2->name, (const xmlChar*)"offset"))
-            var.offset = (char*)strtoul((char*)textElement->content, NULL, 0);
-          else if (!xmlStrcmp(nodeElementLvl2->name, (const xmlChar*)"type")) {
-            if (!xmlStrcmp(textElement->content, (const xmlChar*)"int")) {
-              var.type = VAR_INT;
-            } else if (!xmlStrcmp(textElement->content, (const xmlChar*)"string")) {
-              var.type = VAR_STRING;
-            } else {
-              cerr << "[StateTrigger] Unknown variable type: " << (char*)nodeElementLvl2->content << endl;
-            }
-          } else if (!xmlStrcmp(nodeElementLvl2->name, (const xmlChar*)"value")) {
-            if (VAR_INT == var.type)
-              var.targetValue.targetInt = atoi((char*)textElement->content);
-            else if (VAR_STRING == var.type) {
-              // XXX - check string size
-              strcpy(var.targetValue.targetString, (char*)textElement->content);
-            }
-          } else if (!xmlStrcmp(nodeElementLvl2->name, (const xmlChar*)"frame")) {
-            var.frame = atoi((char*)textElement->content);
-          } else if (!xmlStrcmp(nodeElementLvl2->name, (const xmlChar*)"value")) {
-            var.frame = atoi((char*)textElement->content);
+        if (!field->text[0])
+          continue;
+        if (!strcmp(field->name, "offset"))
+          var.offset = (char*)strtoul(field->text, NULL, 0);
+        else if (!strcmp(field->name, "type")) {
+          if (!strcmp(field->text, "int")) {
+            var.type = VAR_INT;
+          } else if (!strcmp(field->text, "string")) {
+            var.type = VAR_STRING;
+          } else {
+            cerr << "[StateTrigger] Unknown variable type: " << field->text << endl;
+          }
+        } else if (!strcmp(field->name, "value")) {
+          if (VAR_INT == var.type)
+            var.targetValue.targetInt = atoi(field->text);
+          else if (VAR_STRING == var.type) {
+            // XXX - check string size
+            strcpy(var.targetValue.targetString, field->text);
           }
+        } else if (!strcmp(field->name, "frame")) {
+          var.frame = atoi(field->text);
         }
-        nodeElementLvl2 = nodeElementLvl2->next;
       }
       break;
     }
-    nodeElement = nodeElement->next;
   }
 }
 
-struct layout
+bool StateTrigger::Evaluate(const CallContext& ctx)
 {
-  struct layout *bp;
-  void *ret;
-  // void *args[8];
-};
+  char *bp;
 
-#ifdef __APPLE__
-void *__libc_stack_end;
-#else
-extern void *__libc_stack_end;
-#endif
-
-bool StateTrigger::Eval(const string*, ...)
-{
-  int i;
-#ifdef __APPLE__
-  __libc_stack_end = pthread_get_stackaddr_np(pthread_self());
-#endif
   if (VAR_GLOBAL == var.location) {
     if (VAR_INT == var.type) return (var.targetValue.targetInt == *(int*)var.offset);
     return !strcmp(var.targetValue.targetString, (char*)var.offset);
   }
 
-  register void *bpx __asm__ ( REG_BP );
-
-  struct layout *bp = (struct layout *)bpx;
-
-  for (i = (int)var.frame+2; i; --i) {
-    if ((void*)bp > __libc_stack_end || ((long)bp & 3))
-      return false;
-    bp = bp->bp;
-  }
+  /* frame 1 is the function calling the interceptor (frame 0 of the call context) */
+  if (!(bp = (char*)ctx.FramePointer(var.frame - 1)))
+    return false;
   if (VAR_INT == var.type) { 
-    if (var.targetValue.targetInt == *(int*)((char*)bp + (long)var.offset))
+    if (var.targetValue.targetInt == *(int*)(bp + (long)var.offset))
       return true;
     return false;
   }
-  char* target = *(char**)((char*)(bp) + (long)var.offset);
+  char* target = *(char**)(bp + (long)var.offset);
   if (!strcmp(var.targetValue.targetString, target))
     return true;
   return false;
@@ -50,8 +50,8 @@ DEFINE_TRIGGER( StateTrigger )
 {
 public:
   StateTrigger() { };
-  void Init(xmlNodePtr initData);
-  bool Eval(const string* functionName, ...);
+  void Init(const TriggerArg* args);
+  bool Evaluate(const CallContext& ctx);
 private:
   Variable var;
 };
@@ -26,8 +26,13 @@
 
 #include "TimerTrigger.h"
 #include <iostream>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
 
-StartTime TimerTrigger::start;
+/* set up before the stub constructor initializes the triggers */
+StartTime TimerTrigger::start LFI_REGISTRY_INIT;
+vector<TimerTrigger*> TimerTrigger::instances LFI_REGISTRY_INIT;
 
 StartTime::StartTime()
 {
@@ -37,28 +42,90 @@ StartTime::StartTime()
 TimerTrigger::TimerTrigger()
   : wait(0)
   , go(0)
+  , waiting(0)
 {
 }
 
-void TimerTrigger::Init(xmlNodePtr initData)
+void TimerTrigger::Init(const TriggerArg* args)
 {
-  xmlNodePtr nodeElement, textElement;
+  const TriggerArg* arg;
 
-  nodeElement = initData->children;
-  while (nodeElement)
+  for (arg = args ? args->children : NULL; arg; arg = arg->next)
+    if (!strcmp(arg->name, "wait") && arg->text[0])
+      wait = arg->value;
+
+  /* the triggers are initialized by the constructor, before any fork */
+  if (instances.empty())
+    pthread_atfork(NULL, NULL, AtforkChild);
+  instances.push_back(this);
+
+  /*
+     the trigger can't fire before the timeout so keep it disarmed (the
+     stubs then skip its rows) and let a helper thread rearm it
+  */
+  if ((unsigned)time(NULL) - start.st_time < (unsigned)wait)
+  {
+    Disarm();
+    waiting = 1;
+    WaitInBackground();
+  }
+}
+
+void TimerTrigger::WaitInBackground()
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&thread, &attr, ArmLater, this))
   {
-    if (XML_ELEMENT_NODE == nodeElement->type &&
-        !xmlStrcmp(nodeElement->name, (const xmlChar*)"wait"))
-    {
-      textElement = nodeElement->children;
-      if (XML_TEXT_NODE == textElement->type)
-        wait = atoi((char*)textElement->content);
-    }
-    nodeElement = nodeElement->next;
+    waiting = 0;
+    Rearm();
   }
+  pthread_attr_destroy(&attr);
+}
+
+void TimerTrigger::AtforkChild()
+{
+  size_t i;
+
+  for (i = 0; i < instances.size(); ++i)
+    if (instances[i]->waiting)
+      instances[i]->WaitInBackground();
+}
+
+/* the wait starts over with each experiment */
+void TimerTrigger::StartExperiment(unsigned)
+{
+  start.st_time = (unsigned)time(NULL);
+  go = 0;
+  if (wait > 0 && !waiting)
+  {
+    Disarm();
+    waiting = 1;
+    WaitInBackground();
+  }
+}
+
+void* TimerTrigger::ArmLater(void* self)
+{
+  TimerTrigger* t = (TimerTrigger*)self;
+  unsigned int elapsed;
+
+  /* this thread belongs to LFI, never inject in its calls */
+  set_no_intercept(1);
+
+  while ((elapsed = (unsigned)time(NULL) - start.st_time) < (unsigned)t->wait)
+    sleep(t->wait - elapsed);
+
+  t->go = 1;
+  t->waiting = 0;
+  t->Rearm();
+  return NULL;
 }
 
-bool TimerTrigger::Eval(const string*, ...)
+bool TimerTrigger::Evaluate(const CallContext&)
 {
   if (go)
     return true;
@@ -30,17 +30,25 @@ class StartTime
 {
 public:
   StartTime();
-  unsigned int st_time;
+  volatile unsigned int st_time;
 };
 
 DEFINE_TRIGGER( TimerTrigger )
 {
 public:
   TimerTrigger();
-  void Init(xmlNodePtr initData);
-  bool Eval(const string* functionName, ...);
+  void Init(const TriggerArg* args);
+  bool Evaluate(const CallContext& ctx);
+  void StartExperiment(unsigned experiment);
 private:
+  /* disarms the trigger until the wait is over, in a thread of its own */
+  void WaitInBackground();
+  static void* ArmLater(void* self);
+  /* fork doesn't carry the waiting threads over, the child starts them again */
+  static void AtforkChild();
   int wait;
-  int go;
+  volatile int go;
+  volatile int waiting; /* a thread will rearm the trigger */
   static StartTime start;
+  static vector<TimerTrigger*> instances;
 };
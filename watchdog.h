@@ -0,0 +1,46 @@
+/*
+     Created by Paul Marinescu and George Candea
+     Copyright (C) 2009 EPFL (Ecole Polytechnique Federale de Lausanne)
+
+     This file is part of LFI (Library-level Fault Injector).
+
+     LFI is free software: you can redistribute it and/or modify it  
+     under the terms of the GNU General Public License as published by the  
+     Free Software Foundation, either version 3 of the License, or (at  
+     your option) any later version.
+
+     LFI is distributed in the hope that it will be useful, but  
+     WITHOUT ANY WARRANTY; without even the implied warranty of  
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public  
+     License along with LFI. If not, see http://www.gnu.org/licenses/.
+
+     EPFL
+     Dependable Systems Lab (DSLAB)
+     Room 330, Station 14
+     1015 Lausanne
+     Switzerland
+*/
+
+#include <signal.h>
+
+/*
+   hung targets
+
+   With a time budget (libfi -w, -c), libfi sets $LFI_STACKS to the file
+   where a hung target's stacks go. The stub library then handles
+   LFI_STACKS_SIGNAL by appending the backtrace of the thread it
+   interrupts to that file. When the budget runs out, libfi sends it to
+   every thread of the target, one at a time, and kills the target
+*/
+
+#define LFI_STACKS_ENV     "LFI_STACKS"
+#define LFI_STACKS_FILE    "hang.stacks"
+#ifdef __linux__
+#define LFI_STACKS_SIGNAL  (SIGRTMAX - 1)
+#endif
+
+/* installs the handler if $LFI_STACKS is set */
+void lfi_stacks_init(void);